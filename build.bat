@@ -36,6 +36,10 @@ if /i "%MODE%"=="debug" (
 mkdir %TARGET_DIR%
 pushd %TARGET_DIR%
 cl %COMMON_FLAGS% %BUILD_FLAGS% %SRC_DIR%\sdl2_rastertoy.cpp %SRC_DIR%\rastertoy.cpp %LIBS%
+:: Offscreen build for machines without a display, needs no SDL
+cl %COMMON_FLAGS% %BUILD_FLAGS% %SRC_DIR%\headless_rastertoy.cpp %SRC_DIR%\rastertoy.cpp /Fe:headless_rastertoy.exe
+:: Frame benchmark over the meshes in .\data, writes a JSON report
+cl %COMMON_FLAGS% %BUILD_FLAGS% %SRC_DIR%\benchmark_rastertoy.cpp %SRC_DIR%\rastertoy.cpp /Fe:benchmark_rastertoy.exe
 copy "%LIB_DIR%\SDL2.dll" .
 popd
 
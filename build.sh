@@ -16,13 +16,13 @@ COMMON_FLAGS="-I$INCLUDE_DIR"
 if [ $MODE = "debug" ]; then
     echo "Building in Debug mode..."
     BUILD_FLAGS="-g"
-    LIBS="-lSDL2"
+    LIBS="-lSDL2 -pthread"
     TARGET_DIR="debug"
 elif  [ $MODE = "release" ];
 then
     echo "Building in Release mode..."
     BUILD_FLAGS="-O2"
-    LIBS="-lSDL2"
+    LIBS="-lSDL2 -pthread"
     TARGET_DIR="release"
 else
     echo "Invalid mode! Use \"debug\" or \"release\"."
@@ -34,3 +34,9 @@ mkdir -p $TARGET_DIR
 
 # Compile the program using gcc
 g++ --std=c++11 $COMMON_FLAGS $BUILD_FLAGS $SRC_DIR/sdl2_rastertoy.cpp $SRC_DIR/rastertoy.cpp -o $TARGET_DIR/sdl2_rastertoy $LIBS
+
+# Offscreen build for machines without a display, needs no SDL
+g++ --std=c++11 $COMMON_FLAGS $BUILD_FLAGS $SRC_DIR/headless_rastertoy.cpp $SRC_DIR/rastertoy.cpp -o $TARGET_DIR/headless_rastertoy -pthread
+
+# Frame benchmark over the meshes in ./data, writes a JSON report
+g++ --std=c++11 $COMMON_FLAGS $BUILD_FLAGS $SRC_DIR/benchmark_rastertoy.cpp $SRC_DIR/rastertoy.cpp -o $TARGET_DIR/benchmark_rastertoy -pthread
@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "platform.h"
+
+/*
+Offscreen frame benchmark. Every mesh is rendered in every render mode and shading mode while
+a fixed script rotates the object and moves the camera (or only moves the light), the same way
+on every run. Results go out as JSON so runs can be compared by tools.
+*/
+
+struct benchmark_options
+{
+    std::vector<std::string> meshes;    // Files in ./data, an empty name means the default cube.
+    std::string outputPath;             // JSON goes to stdout when empty.
+    i32 frames;
+    i32 warmupFrames;
+    i32 width;
+    i32 height;
+    f32 deltaTime;
+    bool packed;                        // Models stored packed, like pressing c.
+    f32 lodErrorPixels;                 // See rastertoy::SetLodErrorThreshold.
+    bool moveLight;                     // The script moves the light instead of the object and camera.
+    bool meshCache;                     // Models go through their .rtmesh caches instead of being parsed.
+};
+
+struct benchmark_mode
+{
+    const char *name;
+    KeyCode key;
+};
+
+struct benchmark_result
+{
+    f64 minMs;
+    f64 medianMs;
+    f64 p99Ms;
+    f64 meanMs;
+    f64 trianglesPerFrame;
+    f64 trianglesPerSecond;
+    f64 pixelsPerSecond;
+
+    // Per frame averages, only filled with PERF_ON
+    f64 stageMs[PERF_STAGE_COUNT];
+    f64 counters[PERF_COUNTER_COUNT];
+    std::vector<PerfObject> objects;    // Summed over the frames, then divided by their count.
+};
+
+static const benchmark_mode RENDER_MODES[] =
+{
+    { "RENDER_WIREFRAME", KEY_W },
+    { "RENDER_SOLID", KEY_S },
+    { "RENDER_SOLID_WIREFRAME", KEY_D }
+};
+
+static const benchmark_mode SHADING_MODES[] =
+{
+    { "SHADE_FLAT", KEY_F },
+    { "SHADE_GOURAUD", KEY_G },
+    { "SHADE_PHONG", KEY_P },
+    { "SHADE_PHONG_PREPASS", KEY_Z },
+    { "SHADE_DEFERRED", KEY_R }
+};
+
+static const std::string CORRECT_USAGE_STRING =
+"Correct Usage: ./benchmark_rastertoy [options] [list of obj files, \"cube\" for the default cube]\n"
+"   --frames N      measured frames per mode (default 60).\n"
+"   --warmup N      unmeasured frames before every mode (default 5).\n"
+"   --size WxH      size of the offscreen buffer (default 1280x720).\n"
+"   --out PATH      write the JSON report to PATH instead of stdout.\n"
+"   --packed        measure packed models (quantized positions and normals).\n"
+"   --lod-error PX  screen-space error allowed for levels of detail, 0 for full meshes (default 1).\n"
+"   --move-light    only move the light, which SHADE_DEFERRED handles without redrawing.\n"
+"   --mesh-cache    load models through their .rtmesh caches. Without it every OBJ is parsed and no\n"
+"                   cache is read or written.\n"
+"Without obj files the cube, bunny.obj, cow.obj, head.OBJ and teapot.obj are measured.";
+
+static bool ParseCommandLineArgs(int argc, char **argv, benchmark_options& options);
+static i64 MeshFileSize(const std::string& name);
+static benchmark_result RunMode(const benchmark_options& options, const benchmark_mode& render, const benchmark_mode& shading);
+static void WritePerfJSON(std::ostream& out, const benchmark_result& result);
+static void WriteJSON(std::ostream& out, const benchmark_options& options, const std::vector<std::string>& rows);
+static void PrintCorrectUsage();
+
+// Entry point ********************************************************************
+int
+main(int argc, char *argv[])
+{
+    benchmark_options options;
+    if (!ParseCommandLineArgs(argc, argv, options))
+    {
+        PrintCorrectUsage();
+        return 1;
+    }
+
+    // Resource Acquisition -----------------------------------------------------
+    i32 bytesPerPixel = sizeof(u32);
+    std::vector<u32> bufferMemory(options.width * options.height);
+    PlatformScreenDevice ScreenDevice =
+    CreatePlatformScreenDevice(bufferMemory.data(),
+                               options.width,
+                               options.height,
+                               static_cast<f32>(options.width) / options.height,
+                               bytesPerPixel);
+
+    // Runs ------------------------------------------------------------------------
+    std::vector<std::string> rows;
+    for (const std::string& mesh : options.meshes)
+    {
+        std::string meshName = mesh.empty() ? "cube" : mesh;
+        i64 meshBytes = mesh.empty() ? 0 : MeshFileSize(mesh);
+        if (meshBytes < 0)
+        {
+            std::cerr << "[WARNING]: " << mesh << " not found in ./data, skipped" << std::endl;
+            continue;
+        }
+
+        // The application talks a lot on stdout, which is where the report may go
+        std::streambuf *coutBuffer = std::cout.rdbuf(nullptr);
+        std::vector<std::string> objFiles;
+        if (!mesh.empty())
+        {
+            objFiles.push_back(mesh);
+        }
+        auto loadStart = std::chrono::steady_clock::now();
+        rastertoy::SetMeshCache(options.meshCache);
+        rastertoy::OnLaunch(ScreenDevice, objFiles);
+        rastertoy::FinishLoading();
+        rastertoy::ProcessInput(options.packed ? KEY_C : KEY_V);
+        rastertoy::SetLodErrorThreshold(options.lodErrorPixels);
+        f64 loadMs = PerfMsSince(loadStart);
+        // load_ms also covers welding, simplification and meshlet building, the throughput is the parser's alone
+        f64 parseMs = rastertoy::LoadParseMs();
+        f64 parseMBPerSecond = parseMs > 0 ? meshBytes / (1024.0 * 1024.0) / (parseMs / 1000.0) : 0.0;
+
+        for (const benchmark_mode& render : RENDER_MODES)
+        {
+            for (const benchmark_mode& shading : SHADING_MODES)
+            {
+                benchmark_result result = RunMode(options, render, shading);
+
+                std::ostringstream row;
+                row << std::fixed << std::setprecision(4)
+                    << "{ \"mesh\": \"" << meshName << "\""
+                    << ", \"render_mode\": \"" << render.name << "\""
+                    << ", \"shading\": \"" << shading.name << "\""
+                    << ", \"frames\": " << options.frames
+                    << ", \"load_ms\": " << loadMs
+                    << ", \"parse_ms\": " << parseMs
+                    << ", \"min_ms\": " << result.minMs
+                    << ", \"median_ms\": " << result.medianMs
+                    << ", \"p99_ms\": " << result.p99Ms
+                    << ", \"mean_ms\": " << result.meanMs
+                    << std::setprecision(1)
+                    << ", \"triangles_per_frame\": " << result.trianglesPerFrame
+                    << ", \"triangles_per_second\": " << result.trianglesPerSecond
+                    << ", \"pixels_per_second\": " << result.pixelsPerSecond
+                    << ", \"parse_mb_per_second\": " << parseMBPerSecond;
+                WritePerfJSON(row, result);
+                row << " }";
+                rows.push_back(row.str());
+            }
+        }
+
+        rastertoy::OnShutdown();
+        std::cout.rdbuf(coutBuffer);
+        std::cerr << "[INFO]: " << meshName << " done" << std::endl;
+    }
+
+    // Report ----------------------------------------------------------------------
+    if (options.outputPath.empty())
+    {
+        WriteJSON(std::cout, options, rows);
+    }
+    else
+    {
+        std::ofstream file(options.outputPath);
+        if (!file.is_open())
+        {
+            std::cerr << "[ERROR]: Could not open " << options.outputPath << " for writing" << std::endl;
+            return 1;
+        }
+        WriteJSON(file, options, rows);
+    }
+
+    return 0;
+}
+
+// Platform API compliance functions -----------------------------------------
+
+[[nodiscard]] static PlatformScreenDevice
+CreatePlatformScreenDevice(void * backBufferMemory,
+                     i32 width, i32 height,
+                     f32 aspectRatio, i32 bytesPerPixel)
+{
+    return
+    {
+        backBufferMemory,
+        aspectRatio,
+        width,
+        height,
+        width * bytesPerPixel,
+        bytesPerPixel
+    };
+}
+
+// Benchmark-Specific functions --------------------------------------------------
+
+// Size in bytes, -1 when the file is missing
+static i64
+MeshFileSize(const std::string& name)
+{
+    // Same places LoadObjectFromOBJ looks in
+    std::ifstream file("./data/" + name, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        file.open("../data/" + name, std::ios::binary | std::ios::ate);
+    }
+    return file.is_open() ? static_cast<i64>(file.tellg()) : -1;
+}
+
+// Measures one mode. The object turns one way for the first half of the frames while the camera
+// rises, then both go back, so every mode starts from the same view. With moveLight the light
+// goes up and right and comes back instead.
+static benchmark_result
+RunMode(const benchmark_options& options, const benchmark_mode& render, const benchmark_mode& shading)
+{
+    rastertoy::ProcessInput(render.key);
+    rastertoy::ProcessInput(shading.key);
+
+    for (i32 frame = 0; frame < options.warmupFrames; ++frame)
+    {
+        rastertoy::UpdateRenderLoop(options.deltaTime);
+    }
+
+    std::vector<f64> frameMs(options.frames);
+    u64 triangles = 0;
+    u64 pixels = 0;
+    PERF_ONLY(f64 perfStageMs[PERF_STAGE_COUNT] = {});
+    PERF_ONLY(u64 perfCounters[PERF_COUNTER_COUNT] = {});
+    PERF_ONLY(std::vector<PerfObject> perfObjects);
+    for (i32 frame = 0; frame < options.frames; ++frame)
+    {
+        bool firstHalf = frame < options.frames / 2;
+        if (options.moveLight)
+        {
+            rastertoy::ProcessInput(firstHalf ? KEY_UP : KEY_DOWN);
+            rastertoy::ProcessInput(firstHalf ? KEY_RIGHT : KEY_LEFT);
+        }
+        else
+        {
+            rastertoy::ProcessInput(firstHalf ? KEY_Q : KEY_E);
+            rastertoy::ProcessInput(firstHalf ? KEY_SPACE : KEY_LCTRL);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        rastertoy::UpdateRenderLoop(options.deltaTime);
+        auto end = std::chrono::steady_clock::now();
+        frameMs[frame] = std::chrono::duration<f64, std::milli>(end - start).count();
+
+        RenderStats stats = rastertoy::LastFrameStats();
+        triangles += stats.trianglesDrawn;
+        pixels += stats.pixelsWritten;
+
+#ifdef PERF_ON
+        const PerfFrame& perf = rastertoy::LastFramePerf();
+        for (i32 stage = 0; stage < PERF_STAGE_COUNT; ++stage) perfStageMs[stage] += perf.stageMs[stage];
+        for (i32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter) perfCounters[counter] += perf.counters[counter];
+        for (const PerfObject& object : perf.objects)
+        {
+            auto same = [&](const PerfObject& o) { return o.objectIndex == object.objectIndex; };
+            auto found = std::find_if(perfObjects.begin(), perfObjects.end(), same);
+            if (found == perfObjects.end())
+            {
+                perfObjects.push_back(object);
+                continue;
+            }
+            found->vertices += object.vertices;
+            found->trianglesIn += object.trianglesIn;
+            found->trianglesDrawn += object.trianglesDrawn;
+            found->ms += object.ms;
+        }
+#endif
+    }
+
+    benchmark_result result = {};
+    if (options.frames == 0)
+    {
+        return result;
+    }
+
+    f64 totalMs = 0;
+    for (f64 ms : frameMs)
+    {
+        totalMs += ms;
+    }
+
+    std::sort(frameMs.begin(), frameMs.end());
+    size_t p99Index = (frameMs.size() * 99 + 99) / 100 - 1;
+    result.minMs = frameMs.front();
+    result.medianMs = frameMs.size() % 2 ? frameMs[frameMs.size() / 2]
+                                         : 0.5 * (frameMs[frameMs.size() / 2 - 1] + frameMs[frameMs.size() / 2]);
+    result.p99Ms = frameMs[std::min(p99Index, frameMs.size() - 1)];
+    result.meanMs = totalMs / options.frames;
+    result.trianglesPerFrame = static_cast<f64>(triangles) / options.frames;
+    result.trianglesPerSecond = totalMs > 0 ? triangles * 1000.0 / totalMs : 0;
+    result.pixelsPerSecond = totalMs > 0 ? pixels * 1000.0 / totalMs : 0;
+
+#ifdef PERF_ON
+    for (i32 stage = 0; stage < PERF_STAGE_COUNT; ++stage) result.stageMs[stage] = perfStageMs[stage] / options.frames;
+    for (i32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter) result.counters[counter] = static_cast<f64>(perfCounters[counter]) / options.frames;
+    for (PerfObject& object : perfObjects)
+    {
+        object.vertices /= options.frames;
+        object.trianglesIn /= options.frames;
+        object.trianglesDrawn /= options.frames;
+        object.ms /= options.frames;
+    }
+    result.objects = perfObjects;
+#endif
+    return result;
+}
+
+// Nothing without PERF_ON, otherwise the stage, counter and per object averages
+static void
+WritePerfJSON(std::ostream& out, const benchmark_result& result)
+{
+#ifdef PERF_ON
+    out << ", \"stages_ms\": {";
+    for (i32 stage = 0; stage < PERF_STAGE_COUNT; ++stage)
+    {
+        out << (stage ? ", " : " ") << "\"" << PerfStageName(stage) << "\": " << std::setprecision(4) << result.stageMs[stage];
+    }
+    out << " }, \"counters\": {";
+    for (i32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+    {
+        out << (counter ? ", " : " ") << "\"" << PerfCounterName(counter) << "\": " << std::setprecision(1) << result.counters[counter];
+    }
+    out << " }, \"objects\": [";
+    for (size_t i = 0; i < result.objects.size(); ++i)
+    {
+        const PerfObject& object = result.objects[i];
+        out << (i ? ", " : " ")
+            << "{ \"index\": " << object.objectIndex
+            << ", \"vertices\": " << object.vertices
+            << ", \"triangles_in\": " << object.trianglesIn
+            << ", \"triangles_drawn\": " << object.trianglesDrawn
+            << ", \"ms\": " << std::setprecision(4) << object.ms << " }";
+    }
+    out << " ]";
+#else
+    (void) out;
+    (void) result;
+#endif
+}
+
+static void
+WriteJSON(std::ostream& out, const benchmark_options& options, const std::vector<std::string>& rows)
+{
+    out << "{\n"
+        << "  \"width\": " << options.width << ",\n"
+        << "  \"height\": " << options.height << ",\n"
+        << "  \"frames\": " << options.frames << ",\n"
+        << "  \"warmup_frames\": " << options.warmupFrames << ",\n"
+        << "  \"packed\": " << (options.packed ? "true" : "false") << ",\n"
+        << "  \"lod_error_px\": " << options.lodErrorPixels << ",\n"
+        << "  \"move_light\": " << (options.moveLight ? "true" : "false") << ",\n"
+        << "  \"mesh_cache\": " << (options.meshCache ? "true" : "false") << ",\n"
+        << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+#ifdef PERF_ON
+        << "  \"perf\": true,\n"
+#else
+        << "  \"perf\": false,\n"
+#endif
+        << "  \"runs\": [\n";
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        out << "    " << rows[i] << (i + 1 < rows.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n"
+        << "}" << std::endl;
+}
+
+static bool
+ParseCommandLineArgs(int argc, char **argv, benchmark_options& options)
+{
+    options.frames = 60;
+    options.warmupFrames = 5;
+    options.width = 1280;
+    options.height = 720;
+    options.deltaTime = 0.016f;
+    options.packed = false;
+    options.lodErrorPixels = 1.0f;
+    options.moveLight = false;
+    options.meshCache = false;
+
+    for (i32 i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--frames" && hasValue)
+        {
+            options.frames = std::atoi(argv[++i]);
+        }
+        else if (arg == "--warmup" && hasValue)
+        {
+            options.warmupFrames = std::atoi(argv[++i]);
+        }
+        else if (arg == "--size" && hasValue)
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--out" && hasValue)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (arg == "--packed")
+        {
+            options.packed = true;
+        }
+        else if (arg == "--lod-error" && hasValue)
+        {
+            options.lodErrorPixels = static_cast<f32>(std::atof(argv[++i]));
+        }
+        else if (arg == "--move-light")
+        {
+            options.moveLight = true;
+        }
+        else if (arg == "--mesh-cache")
+        {
+            options.meshCache = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            return false;
+        }
+        else
+        {
+            options.meshes.push_back(arg == "cube" ? "" : arg);
+        }
+    }
+
+    if (options.meshes.empty())
+    {
+        options.meshes = { "", "bunny.obj", "cow.obj", "head.OBJ", "teapot.obj" };
+    }
+    return options.frames >= 0 && options.warmupFrames >= 0;
+}
+
+static void
+PrintCorrectUsage()
+{
+    std::cerr << CORRECT_USAGE_STRING << std::endl;
+}
@@ -23,14 +23,19 @@ union frustum
 
 bool SphereInFrustum(const sphere& BoundingSphere,  const frustum& F);
 
+const f32 CAMERA_FAR_DISTANCE = 10000.0f;    // View space depth of the far plane.
+
 /*
-220 bytes
+332 bytes
 */
 class camera
 {
 private:
     frustum cullFrustum_;       // Defines the volume of visible world objects.
     mat4x4 viewMatrix_;         // Encodes the homogeneous transforms of the camera which when  applied to world object gives the illustion of motion.
+    mat4x4 projection_;         // View space to clip space, see ClipOutcode.
+    mat3x3 rotation_;           // Upper 3x3 of viewMatrix_, kept in sync with it.
+    u32 viewVersion_;           // Bumped every time viewMatrix_ changes.
     vec3f origin_;              // The camera's location in 3d space.
     vec3f foreward_;            // Vector pointing in the "forward" direction from the camera's perspective.
     vec3f up_;                  // Vector pointing in the "up" direction from the camera's perspective.
@@ -57,33 +62,39 @@ public:
 
     const frustum& CameraFrustum() const { return cullFrustum_; }
     const mat4x4& CameraViewMatrix() const { return viewMatrix_; }
-    const mat3x3 CameraRotation() const
-    {
-        return 
-        {
-            viewMatrix_.r0.x, viewMatrix_.r0.y, viewMatrix_.r0.z,
-            viewMatrix_.r1.x, viewMatrix_.r1.y, viewMatrix_.r1.z,
-            viewMatrix_.r2.x, viewMatrix_.r2.y, viewMatrix_.r2.z
-        };
-    }
+    const mat4x4& CameraProjection() const { return projection_; }
+    const mat3x3& CameraRotation() const { return rotation_; }
+    u32 ViewVersion() const { return viewVersion_; }
     const vec3f& CameraOrigin() const { return origin_; }
     f32 CameraFocalLength() const { return focalLength_; }
     f32 CameraViewportWidth() const { return viewportWidth_; }
     f32 CameraViewportHeight() const { return viewportHeight_; }
     
-    bool ObjectInFrustum(Object3D *O) const 
+    // O's bounding sphere moved into view space
+    sphere ObjectViewSphere(Object3D *O) const
     {
         sphere bSphere = O->ObjectBoundingSphere();
-        bSphere.center = bSphere.center *  viewMatrix_;
- 
-        // true if the plane is behind the listed plane
+        bSphere.center = bSphere.center * viewMatrix_;
+        return bSphere;
+    }
+
+    // View space point to homogeneous clip space
+    vec4f ViewToClip(const vec3f& p) const
+    {
+        return vec4f{p.x, p.y, p.z, 1.0f} * projection_;
+    }
+
+    bool ViewSphereInFrustum(const sphere& bSphere) const
+    {
+        // true if the sphere is completely behind the listed plane
         bool near =  plane_sphere_intersection_check(cullFrustum_.near, bSphere) < -bSphere.radius;
+        bool far =  plane_sphere_intersection_check(cullFrustum_.far, bSphere) < -bSphere.radius;
         bool left =  plane_sphere_intersection_check(cullFrustum_.left, bSphere) < -bSphere.radius;
         bool right =  plane_sphere_intersection_check(cullFrustum_.right, bSphere) < -bSphere.radius;
         bool top =  plane_sphere_intersection_check(cullFrustum_.top, bSphere) < -bSphere.radius;
         bool bottom =  plane_sphere_intersection_check(cullFrustum_.bottom, bSphere) < -bSphere.radius;
 
-        bool results[] = { near, left, right };
+        bool results[] = { near, far, left, right, top, bottom };
         for (auto result : results)
         {
             if (result)
@@ -95,15 +106,43 @@ public:
         return true;
     }
 
+    bool ObjectInFrustum(Object3D *O) const 
+    {
+        return ViewSphereInFrustum(ObjectViewSphere(O));
+    }
+
     void MoveBy(const vec3f& position) 
     {
         mat4x4 move = I_MATRIX_4X4;
         move.r3 = {position.x, position.y, position.z, 1};
         viewMatrix_ *= move;
+        ViewChanged();
     }
     void RotateYBy(f32 deg)
     {
         viewMatrix_ *= get_y_rotation_mat_inverse(deg);
+        ViewChanged();
+    }
+
+    // Concatenates O's model matrices with the view once, so every vertex needs a single
+    // transform. Only rebuilds them when O or the camera moved since the last call.
+    void UpdateObjectMatrices(Object3D *O) const
+    {
+        if (!O->transformDirty && O->matricesViewVersion == viewVersion_)
+        {
+            return;
+        }
+
+        O->modelView = O->ObjectTransform() * viewMatrix_;
+        mat4x4 normal = O->ObjectRotation() * viewMatrix_;
+        O->normalMatrix =
+        {
+            normal.r0.x, normal.r0.y, normal.r0.z,
+            normal.r1.x, normal.r1.y, normal.r1.z,
+            normal.r2.x, normal.r2.y, normal.r2.z
+        };
+        O->matricesViewVersion = viewVersion_;
+        O->transformDirty = false;
     }
 
     vec3f ViewDirection(const vec3f& v)
@@ -112,8 +151,20 @@ public:
     }
     
 private:
+    void ViewChanged()
+    {
+        rotation_ =
+        {
+            viewMatrix_.r0.x, viewMatrix_.r0.y, viewMatrix_.r0.z,
+            viewMatrix_.r1.x, viewMatrix_.r1.y, viewMatrix_.r1.z,
+            viewMatrix_.r2.x, viewMatrix_.r2.y, viewMatrix_.r2.z
+        };
+        ++viewVersion_;
+    }
+
     void initialize()
     {
+        viewVersion_ = 0;
         viewportHeight_ = 2 * focalLength_ * std::tan(vFov_ / 2);
         viewportWidth_ = viewportHeight_ * aspectRatio_;
 
@@ -124,6 +175,7 @@ private:
             foreward_.x,    foreward_.y,    foreward_.z,    0.0f,
             origin_.x,      origin_.y,      origin_.z,      1.0f
         };
+        ViewChanged();
 
         // We need the corners of the near plane
         vec3f v = viewportHeight_ * up_;                // Vector up along the viewport
@@ -135,190 +187,197 @@ private:
         vec3f botLeftCorner = d - 0.5 * v - 0.5 * u;
 
         cullFrustum_.near =    {{0, 0, 1}, -focalLength_};
+        cullFrustum_.far =     {{0, 0, -1}, CAMERA_FAR_DISTANCE};
         cullFrustum_.left =    {cross(topLeftCorner, botLeftCorner), 0};
         cullFrustum_.right =   {cross(botRightCorner, topRightCorner), 0};
         cullFrustum_.top =     {cross(topRightCorner, topLeftCorner), 0};
         cullFrustum_.bottom =  {cross(botLeftCorner, botRightCorner), 0};
+
+        // Unit normals so the sphere tests can compare distances against radii
+        normalize(cullFrustum_.left.normal);
+        normalize(cullFrustum_.right.normal);
+        normalize(cullFrustum_.top.normal);
+        normalize(cullFrustum_.bottom.normal);
+
+        // Same projection as the viewport one, x and y land in [-w, w] inside the side planes, z
+        // goes from 0 at the near plane to w at the far one and w is the view space depth
+        f32 projectionDistance = origin_.z + focalLength_;
+        f32 depthScale = CAMERA_FAR_DISTANCE / (CAMERA_FAR_DISTANCE - focalLength_);
+        projection_ =
+        {
+            2.0f * projectionDistance / viewportWidth_,     0.0f,                                           0.0f,                           0.0f,
+            0.0f,                                           2.0f * projectionDistance / viewportHeight_,    0.0f,                           0.0f,
+            0.0f,                                           0.0f,                                           depthScale,                     1.0f,
+            0.0f,                                           0.0f,                                           -depthScale * focalLength_,     0.0f
+        };
     }
 };
 
-// CULLING OPERATIONS ----------------------------------------------------------------------------------------
+// CLIPPING OPERATIONS ---------------------------------------------------------------------------------------
 
-struct FrustumPointResults
+/*
+Clipping happens in homogeneous clip space, where the frustum is -w <= x <= w, -w <= y <= w and
+0 <= z <= w. The view to clip transform is linear so a parameter found on a clip space edge also
+interpolates the view space vertex exactly.
+
+The rasterizer scissors anything that fits in its guard band, so the side planes only need
+clipping when a vertex is past the guard band too. Most triangles at the screen edges skip the
+clipper and only the ones crossing the near or far plane pay for it.
+*/
+enum clip_plane_bits
 {
-    f32 side;
-    plane p;
+    CLIP_NEAR   = 1 << 0,
+    CLIP_FAR    = 1 << 1,
+    CLIP_LEFT   = 1 << 2,
+    CLIP_RIGHT  = 1 << 3,
+    CLIP_TOP    = 1 << 4,
+    CLIP_BOTTOM = 1 << 5,
+
+    // Same order as the side planes, past the guard band on that side
+    CLIP_GUARD_LEFT     = 1 << 6,
+    CLIP_GUARD_RIGHT    = 1 << 7,
+    CLIP_GUARD_TOP      = 1 << 8,
+    CLIP_GUARD_BOTTOM   = 1 << 9,
 };
 
-FrustumPointResults
-FrustumCullPoint(const point3f& p,  const frustum& F)
+const u32 CLIP_PLANE_COUNT = 6;
+const u32 CLIP_FRUSTUM_BITS = (1 << CLIP_PLANE_COUNT) - 1;
+const u32 MAX_CLIPPED_VERTICES = 9;     // Every plane adds at most one vertex to a triangle.
+
+// Signed distance to a plane up to a positive scale, not negative on the inside
+inline f32
+ClipPlaneDistance(const vec4f& clip, u32 plane)
 {
-    FrustumPointResults Near =
+    switch (plane)
     {
-        plane_point_intersect(F.near, p),
-        F.near
-    };
-    FrustumPointResults Left =
-    {
-        plane_point_intersect(F.left, p),
-        F.left
-    };
-    FrustumPointResults Right =
-    {
-        plane_point_intersect(F.right, p),
-        F.right
-    };
-    FrustumPointResults Top =
-    {
-        plane_point_intersect(F.top, p),
-        F.top
-    };
-    FrustumPointResults Bottom  =
-    {
-        plane_point_intersect(F.bottom, p),
-        F.bottom
-    };
+        case 0:  return clip.z;
+        case 1:  return clip.w - clip.z;
+        case 2:  return clip.w + clip.x;
+        case 3:  return clip.w - clip.x;
+        case 4:  return clip.w - clip.y;
+        default: return clip.w + clip.y;
+    }
+}
 
-    FrustumPointResults Results[] = { Near, Left, Right };
-    for (auto result : Results)
+// One clip_plane_bits bit for every plane the point is outside of. guardBand is the half size of
+// the guard band in NDC units, at least 1.
+inline u32
+ClipOutcode(const vec4f& clip, const vec2f& guardBand)
+{
+    u32 outcode = 0;
+    for (u32 plane = 0; plane < CLIP_PLANE_COUNT; ++plane)
     {
-        if (result.side < 0)
+        if (ClipPlaneDistance(clip, plane) < 0)
         {
-            return {-1, result.p};
+            outcode |= 1 << plane;
         }
     }
 
-    FrustumPointResults out = {};
-    out.side = 1;
-    return out;
+    if (clip.x < -guardBand.x * clip.w) outcode |= CLIP_GUARD_LEFT;
+    if (clip.x >  guardBand.x * clip.w) outcode |= CLIP_GUARD_RIGHT;
+    if (clip.y >  guardBand.y * clip.w) outcode |= CLIP_GUARD_TOP;
+    if (clip.y < -guardBand.y * clip.w) outcode |= CLIP_GUARD_BOTTOM;
+    return outcode;
 }
 
-struct ClippedTriangle
+// The frustum planes a primitive with these (OR'd) outcodes still has to be clipped against
+// when everything inside the guard band is left to the rasterizer's scissor
+inline u32
+GuardBandClipPlanes(u32 outcodes)
 {
-    // Indices for these are {0 1 2} - {0 2 3} for double
-    // and {0 1 2} for single
-    vertex3 v0, v1, v2, v3;
-    bool IsSplit;
-    bool IsIn;
-};
+    return (outcodes & (CLIP_NEAR | CLIP_FAR)) | ((outcodes >> 4) & (CLIP_LEFT | CLIP_RIGHT | CLIP_TOP | CLIP_BOTTOM));
+}
 
-// Naive approach 1 plane intersection 
-ClippedTriangle
-ClipTriangle(const vertex3& v0, const vertex3& v1, const vertex3& v2, const frustum& F)
+/*
+44 bytes
+*/
+struct clip_vertex
 {
-    ClippedTriangle results = {};
-    results.IsIn = false;
+    vertex3 view;   // View space vertex.
+    vec4f clip;     // view.point through the camera projection.
+};
 
-    // How many vertices in front?
-    FrustumPointResults d0 = FrustumCullPoint(v0.point, F);
-    FrustumPointResults d1 = FrustumCullPoint(v1.point, F);
-    FrustumPointResults d2 = FrustumCullPoint(v2.point, F);
+/*
+400 bytes
+*/
+struct ClippedPolygon
+{
+    // Convex, fan it from v[0] to draw it
+    clip_vertex v[MAX_CLIPPED_VERTICES];
+    u32 count;
+};
 
-    if (d0.side == 1 && d1.side == 1 && d2.side == 1)
-    {
-        results.IsIn = true;
-        results.IsSplit = true;
-        results.v0 = v0;
-        results.v1 = v1;
-        results.v2 = v2;
-        return results;
-    }
-    
-    if (d0.side == -1 && d1.side == -1 && d2.side == -1)
+inline color4
+lerp_color(const color4& a, const color4& b, f32 t)
+{
+    return
     {
-        return results;
-    }
+        static_cast<unsigned char>(a.r + (b.r - a.r) * t + 0.5f),
+        static_cast<unsigned char>(a.g + (b.g - a.g) * t + 0.5f),
+        static_cast<unsigned char>(a.b + (b.b - a.b) * t + 0.5f),
+        static_cast<unsigned char>(a.a + (b.a - a.a) * t + 0.5f)
+    };
+}
 
-    // Create new triangles from clipped triangle
-    vertex3 A;
-    vertex3 B;
-    vertex3 C;
-    plane P;
-    // Case 1: 1 point above the plane
-    if (d0.side * d1.side * d2.side == 1)
+inline clip_vertex
+lerp_clip_vertex(const clip_vertex& a, const clip_vertex& b, f32 t)
+{
+    return
     {
-        if (d0.side == 1) // if you are inside you have no planes to test intercept chose one of the other
-        {
-            A = v0;
-            B = v1;
-            C = v2;
-            P = d1.p;
-        }
-        else if (d1.side == 1)
-        {
-            A = v1;
-            B = v0;
-            C = v2;
-            P = d0.p;
-        }
-        else
         {
-            A = v2;
-            B = v0;
-            C = v1;
-            P = d1.p;
-        }
+            a.view.point + (b.view.point - a.view.point) * t,
+            a.view.normal + (b.view.normal - a.view.normal) * t,
+            lerp_color(a.view.color, b.view.color, t)
+        },
+        a.clip + (b.clip - a.clip) * t
+    };
+}
 
-        // Find intersection AB with a plane P (B') and AC with a plane P (C')
-        // return AB'C'
-        line3d AB = {A.point, B.point};
-        line3d AC = {A.point, C.point};
-        vec3f BPrime = plane_line_intersect(P, AB);
-        vec3f CPrime = plane_line_intersect(P, AC);
-
-        // NOTE: We could add linear interpolated color for B' and C' [but we won't ;)]
-        results.IsIn = true;
-        results.IsSplit = false;
-        results.v0.point = BPrime;
-        results.v0.normal = B.normal;
-        results.v0.color = B.color;
-        results.v1 = A;
-        results.v2.point = CPrime;
-        results.v2.normal = C.normal;
-        results.v2.color = C.color;
-    }
-    // Case 2: 2 points above the plane
-    else
+/*
+Sutherland-Hodgman against the planes in the outcode bits, which should be the union of the
+vertices' outcodes. A polygon with fewer than 3 vertices left is completely outside.
+*/
+ClippedPolygon
+ClipTriangle(const clip_vertex& v0, const clip_vertex& v1, const clip_vertex& v2, u32 planes)
+{
+    ClippedPolygon result = {};
+    result.v[0] = v0;
+    result.v[1] = v1;
+    result.v[2] = v2;
+    result.count = 3;
+
+    clip_vertex scratch[MAX_CLIPPED_VERTICES];
+    for (u32 plane = 0; plane < CLIP_PLANE_COUNT && result.count >= 3; ++plane)
     {
-        if (d0.side == -1)
+        if (!(planes & (1 << plane)))
         {
-            C = v0;
-            A = v1;
-            B = v2;
-            P = d0.p;
+            continue;
         }
-        else if (d1.side == -1)
-        {
-            C = v1;
-            A = v0;
-            B = v2;
-            P = d1.p;
-        }
-        else
+
+        u32 outCount = 0;
+        for (u32 i = 0; i < result.count; ++i)
         {
-            C = v2;
-            A = v0;
-            B = v1;
-            P = d2.p;
+            const clip_vertex& a = result.v[i];
+            const clip_vertex& b = result.v[(i + 1) % result.count];
+            f32 da = ClipPlaneDistance(a.clip, plane);
+            f32 db = ClipPlaneDistance(b.clip, plane);
+
+            if (da >= 0)
+            {
+                scratch[outCount++] = a;
+            }
+            if ((da >= 0) != (db >= 0))
+            {
+                // Always step from the inside vertex so a shared edge clips to the same point
+                scratch[outCount++] = (da >= 0) ? lerp_clip_vertex(a, b, da / (da - db))
+                                                : lerp_clip_vertex(b, a, db / (db - da));
+            }
         }
 
-        line3d CA = {C.point, A.point};
-        line3d CB = {C.point, B.point};
-        vec3f APrime = plane_line_intersect(P, CA);
-        vec3f BPrime = plane_line_intersect(P, CB);
-
-        results.IsIn = true;
-        results.IsSplit = true;
-        results.v0.point = APrime;
-        results.v0.normal = A.normal;
-        results.v0.color = A.color;
-        results.v1 = A;
-        results.v2 = B;
-        results.v3.point = BPrime;
-        results.v3.normal = B.normal;
-        results.v3.color = B.color;
+        std::copy(scratch, scratch + outCount, result.v);
+        result.count = outCount;
     }
-    return results;
+    return result;
 }
 
 #endif // CAMERA_H
\ No newline at end of file
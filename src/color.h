@@ -96,6 +96,32 @@ linear_interpolate_color(float i, float start_value, color4 start_color, float e
     return { r, g, b, 0xFF }; 
 }
 
+// Inverse of color_uint32
+inline color4
+uint32_color4(unsigned int color)
+{
+    return
+    {
+        static_cast<unsigned char>(color >> 24),
+        static_cast<unsigned char>(color >> 16),
+        static_cast<unsigned char>(color >> 8),
+        static_cast<unsigned char>(color)
+    };
+}
+
+// Builds a color from interpolated r, g, b channels, these can overshoot slightly at triangle edges
+inline color4
+attributes_color4(const float *rgb, unsigned char alpha)
+{
+    return
+    {
+        static_cast<unsigned char>(std::min(std::max(rgb[0], 0.0f), 255.0f)),
+        static_cast<unsigned char>(std::min(std::max(rgb[1], 0.0f), 255.0f)),
+        static_cast<unsigned char>(std::min(std::max(rgb[2], 0.0f), 255.0f)),
+        alpha
+    };
+}
+
 inline std::ostream&
 operator<<(std::ostream& o, const color4& c)
 {
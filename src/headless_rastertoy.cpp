@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <cassert>
+
+#include "platform.h"
+
+/*
+Runs the rasterizer against a plain block of memory instead of a window, for machines without
+a display. It renders a fixed number of frames and optionally writes them out as PPM or PNG.
+*/
+
+struct headless_options
+{
+    std::vector<std::string> objFiles;
+    std::string outputPath;     // .ppm or .png, a %d in it is replaced by the frame number.
+    std::string keys;           // Sent to ProcessInput once before the first frame.
+    i32 frames;
+    i32 width;
+    i32 height;
+    f32 deltaTime;              // Seconds passed to every UpdateRenderLoop.
+    bool everyFrame;            // Write every frame instead of only the last one.
+};
+
+static const std::string CORRECT_USAGE_STRING =
+"Correct Usage: ./headless_rastertoy [options] [list of obj files, each optionally followed by :instance_count]\n"
+"   --frames N      number of frames to render (default 1).\n"
+"   --size WxH      size of the offscreen buffer (default 1280x720).\n"
+"   --dt SECONDS    delta time passed to every frame (default 0.016).\n"
+"   --keys KEYS     keys to press before the first frame, e.g. \"sp\" for solid Phong.\n"
+"   --out PATH      write the last frame to PATH, .ppm or .png. Nothing is written without it.\n"
+"   --every         write every frame, PATH should then contain a %d for the frame number.";
+
+static bool ParseCommandLineArgs(int argc, char **argv, headless_options& options);
+static bool KeyCodeFromChar(char c, KeyCode& key);
+static std::string FramePath(const std::string& outputPath, i32 frame);
+static bool WriteFrame(const std::string& path, const u32 *pixels, i32 width, i32 height);
+static void PrintCorrectUsage();
+
+// Entry point ********************************************************************
+int
+main(int argc, char *argv[])
+{
+    headless_options options;
+    if (!ParseCommandLineArgs(argc, argv, options))
+    {
+        PrintCorrectUsage();
+        return 1;
+    }
+
+    // Resource Acquisition -----------------------------------------------------
+    i32 bytesPerPixel = sizeof(u32);
+    std::vector<u32> bufferMemory(options.width * options.height);
+
+    // Startup Operations -----------------------------------------------------
+    PlatformScreenDevice ScreenDevice =
+    CreatePlatformScreenDevice(bufferMemory.data(),
+                               options.width,
+                               options.height,
+                               static_cast<f32>(options.width) / options.height,
+                               bytesPerPixel);
+
+    rastertoy::OnLaunch(ScreenDevice, options.objFiles);
+    // Frames have to be reproducible, so they don't start before everything is loaded
+    rastertoy::FinishLoading();
+
+    for (char c : options.keys)
+    {
+        KeyCode key;
+        if (KeyCodeFromChar(c, key))
+        {
+            rastertoy::ProcessInput(key);
+        }
+    }
+
+    // Main Loop ---------------------------------------------------------------
+    bool writeFailed = false;
+    f64 totalMs = 0;
+    PERF_ONLY(PerfFrame perfTotal = {});
+    for (i32 frame = 0; frame < options.frames; ++frame)
+    {
+        auto start = std::chrono::steady_clock::now();
+        rastertoy::UpdateRenderLoop(options.deltaTime);
+        auto end = std::chrono::steady_clock::now();
+        totalMs += std::chrono::duration<f64, std::milli>(end - start).count();
+
+#ifdef PERF_ON
+        const PerfFrame& perf = rastertoy::LastFramePerf();
+        for (i32 stage = 0; stage < PERF_STAGE_COUNT; ++stage) perfTotal.stageMs[stage] += perf.stageMs[stage];
+        for (i32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter) perfTotal.counters[counter] += perf.counters[counter];
+        auto presentStart = std::chrono::steady_clock::now();
+#endif
+
+        bool lastFrame = frame == options.frames - 1;
+        if (!options.outputPath.empty() && (options.everyFrame || lastFrame))
+        {
+            if (!WriteFrame(FramePath(options.outputPath, frame), bufferMemory.data(), options.width, options.height))
+            {
+                writeFailed = true;
+                break;
+            }
+        }
+        PERF_ONLY(perfTotal.stageMs[PERF_STAGE_PRESENT] += PerfMsSince(presentStart));
+    }
+
+    if (options.frames > 0)
+    {
+        std::cout << "Frames: " << options.frames << " | Total: " << totalMs << "ms"
+                  << " | Average: " << totalMs / options.frames << "ms" << std::endl;
+#ifdef PERF_ON
+        // Writing the frames out counts as presenting them
+        for (i32 stage = 0; stage < PERF_STAGE_COUNT; ++stage)
+        {
+            std::cout << "    " << PerfStageName(stage) << ": " << perfTotal.stageMs[stage] / options.frames << "ms\n";
+        }
+        for (i32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+        {
+            std::cout << "    " << PerfCounterName(counter) << ": " << perfTotal.counters[counter] / options.frames << "\n";
+        }
+#endif
+    }
+
+    // Resource Release -----------------------------------------------------
+    rastertoy::OnShutdown();
+
+    return writeFailed ? 1 : 0;
+}
+
+// Platform API compliance functions -----------------------------------------
+
+[[nodiscard]] static PlatformScreenDevice
+CreatePlatformScreenDevice(void * backBufferMemory,
+                     i32 width, i32 height,
+                     f32 aspectRatio, i32 bytesPerPixel)
+{
+    return
+    {
+        backBufferMemory,
+        aspectRatio,
+        width,
+        height,
+        width * bytesPerPixel,
+        bytesPerPixel
+    };
+}
+
+// Headless-Specific functions --------------------------------------------------
+
+static bool
+KeyCodeFromChar(char c, KeyCode& key)
+{
+    switch (c)
+    {
+        case 'w': key = KEY_W; return true;
+        case 'f': key = KEY_F; return true;
+        case 's': key = KEY_S; return true;
+        case 'd': key = KEY_D; return true;
+        case 'h': key = KEY_H; return true;
+        case 'g': key = KEY_G; return true;
+        case 'q': key = KEY_Q; return true;
+        case 'e': key = KEY_E; return true;
+        case 'n': key = KEY_N; return true;
+        case 'p': key = KEY_P; return true;
+        case 'a': key = KEY_A; return true;
+        case 'c': key = KEY_C; return true;
+        case 'v': key = KEY_V; return true;
+        case 'l': key = KEY_L; return true;
+        case 'z': key = KEY_Z; return true;
+        case 'r': key = KEY_R; return true;
+        case ' ': key = KEY_SPACE; return true;
+    }
+
+    if (c >= '0' && c <= '9')
+    {
+        key = static_cast<KeyCode>(KEY_0 + (c - '0'));
+        return true;
+    }
+
+    std::cerr << "[WARNING]: Unknown key '" << c << "' ignored" << std::endl;
+    return false;
+}
+
+// PNG -------------------------------------------------------------------------
+// Written with stored (uncompressed) deflate blocks so no zlib is needed.
+
+static u32
+Crc32(const u8 *data, size_t size, u32 crc = 0)
+{
+    static u32 table[256];
+    static bool tableReady = false;
+    if (!tableReady)
+    {
+        for (u32 i = 0; i < 256; ++i)
+        {
+            u32 c = i;
+            for (i32 bit = 0; bit < 8; ++bit)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void
+AppendU32BigEndian(std::vector<u8>& out, u32 value)
+{
+    out.push_back(static_cast<u8>(value >> 24));
+    out.push_back(static_cast<u8>(value >> 16));
+    out.push_back(static_cast<u8>(value >> 8));
+    out.push_back(static_cast<u8>(value));
+}
+
+static void
+AppendPNGChunk(std::vector<u8>& out, const char *type, const std::vector<u8>& data)
+{
+    AppendU32BigEndian(out, static_cast<u32>(data.size()));
+    size_t typeStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    AppendU32BigEndian(out, Crc32(out.data() + typeStart, out.size() - typeStart));
+}
+
+static std::vector<u8>
+EncodePNG(const std::vector<u8>& rgb, i32 width, i32 height)
+{
+    // Every scanline starts with filter type 0 (none)
+    std::vector<u8> raw;
+    raw.reserve((width * 3 + 1) * height);
+    for (i32 y = 0; y < height; ++y)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb.begin() + y * width * 3, rgb.begin() + (y + 1) * width * 3);
+    }
+
+    std::vector<u8> zlib = { 0x78, 0x01 };
+    const size_t MAX_STORED_BLOCK = 65535;
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += MAX_STORED_BLOCK)
+    {
+        size_t size = std::min(MAX_STORED_BLOCK, raw.size() - offset);
+        bool last = offset + size == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<u8>(size));
+        zlib.push_back(static_cast<u8>(size >> 8));
+        zlib.push_back(static_cast<u8>(~size));
+        zlib.push_back(static_cast<u8>(~size >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+    }
+
+    u32 a = 1, b = 0;
+    for (u8 byte : raw)
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    AppendU32BigEndian(zlib, (b << 16) | a);
+
+    std::vector<u8> header;
+    AppendU32BigEndian(header, width);
+    AppendU32BigEndian(header, height);
+    header.push_back(8);    // Bit depth
+    header.push_back(2);    // Color type RGB
+    header.push_back(0);    // Compression
+    header.push_back(0);    // Filter
+    header.push_back(0);    // Interlace
+
+    std::vector<u8> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    AppendPNGChunk(png, "IHDR", header);
+    AppendPNGChunk(png, "IDAT", zlib);
+    AppendPNGChunk(png, "IEND", {});
+    return png;
+}
+
+// Only the first %d is replaced, every other character of the path is taken as it is
+static std::string
+FramePath(const std::string& outputPath, i32 frame)
+{
+    size_t placeholder = outputPath.find("%d");
+    if (placeholder == std::string::npos)
+    {
+        return outputPath;
+    }
+    return outputPath.substr(0, placeholder) + std::to_string(frame) + outputPath.substr(placeholder + 2);
+}
+
+// The back buffer is RGBA8888, red in the high byte
+static bool
+WriteFrame(const std::string& path, const u32 *pixels, i32 width, i32 height)
+{
+    std::vector<u8> rgb(width * height * 3);
+    for (i32 i = 0; i < width * height; ++i)
+    {
+        rgb[i * 3] = static_cast<u8>(pixels[i] >> 24);
+        rgb[i * 3 + 1] = static_cast<u8>(pixels[i] >> 16);
+        rgb[i * 3 + 2] = static_cast<u8>(pixels[i] >> 8);
+    }
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "[ERROR]: Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    bool isPNG = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+    if (isPNG)
+    {
+        std::vector<u8> png = EncodePNG(rgb, width, height);
+        std::fwrite(png.data(), 1, png.size(), file);
+    }
+    else
+    {
+        std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+        std::fwrite(rgb.data(), 1, rgb.size(), file);
+    }
+
+    std::fclose(file);
+    return true;
+}
+
+static bool
+ParseCommandLineArgs(int argc, char **argv, headless_options& options)
+{
+    options.frames = 1;
+    options.width = 1280;
+    options.height = 720;
+    options.deltaTime = 0.016f;
+    options.everyFrame = false;
+
+    for (i32 i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--frames" && hasValue)
+        {
+            options.frames = std::atoi(argv[++i]);
+        }
+        else if (arg == "--size" && hasValue)
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width <= 0 || options.height <= 0)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--dt" && hasValue)
+        {
+            options.deltaTime = static_cast<f32>(std::atof(argv[++i]));
+        }
+        else if (arg == "--keys" && hasValue)
+        {
+            options.keys = argv[++i];
+        }
+        else if (arg == "--out" && hasValue)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (arg == "--every")
+        {
+            options.everyFrame = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            return false;
+        }
+        else
+        {
+            options.objFiles.push_back(arg);
+        }
+    }
+    return options.frames >= 0;
+}
+
+static void
+PrintCorrectUsage()
+{
+    std::cerr << CORRECT_USAGE_STRING << std::endl;
+}
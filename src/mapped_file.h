@@ -0,0 +1,137 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/*
+A whole file mapped read-only into memory. The pages are loaded by the OS as they are touched,
+so nothing is copied up front and the contents can be used in place.
+*/
+class mapped_file
+{
+private:
+    const char *data_;
+    size_t size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#else
+    int file_;
+#endif
+
+public:
+    mapped_file() : data_{nullptr}, size_{0}
+    {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = nullptr;
+#else
+        file_ = -1;
+#endif
+    }
+    ~mapped_file() { Close(); }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // False when the file can't be opened. Empty files open fine with a null Data().
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file_, &fileSize))
+        {
+            Close();
+            return false;
+        }
+        size_ = static_cast<size_t>(fileSize.QuadPart);
+        if (size_ == 0)
+        {
+            return true;
+        }
+
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_ == nullptr)
+        {
+            Close();
+            return false;
+        }
+        data_ = static_cast<const char *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+        file_ = open(path.c_str(), O_RDONLY);
+        if (file_ < 0)
+        {
+            return false;
+        }
+
+        struct stat fileStat;
+        if (fstat(file_, &fileStat) != 0)
+        {
+            Close();
+            return false;
+        }
+        size_ = static_cast<size_t>(fileStat.st_size);
+        if (size_ == 0)
+        {
+            return true;
+        }
+
+        void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file_, 0);
+        data_ = mapping == MAP_FAILED ? nullptr : static_cast<const char *>(mapping);
+        if (data_ != nullptr)
+        {
+            madvise(mapping, size_, MADV_SEQUENTIAL);
+        }
+#endif
+        if (data_ == nullptr)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (data_ != nullptr) UnmapViewOfFile(data_);
+        if (mapping_ != nullptr) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_ != nullptr) munmap(const_cast<char *>(data_), size_);
+        if (file_ >= 0) close(file_);
+        file_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const char *Data() const { return data_; }
+    size_t Size() const { return size_; }
+};
+
+#endif // MAPPED_FILE_H
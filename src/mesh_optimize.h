@@ -0,0 +1,290 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/*
+Load time reordering of welded meshes, run before a model is cached:
+1. Triangles are reordered for post-transform vertex reuse (Forsyth's linear-speed algorithm).
+2. The result is cut into clusters where the cache restarts, and the clusters are sorted so the
+   outward facing ones come first, which cuts overdraw without giving up much of the reuse.
+3. Vertices are renumbered in the order the triangles first use them, so fetching them walks
+   memory forwards.
+*/
+
+const u32 MESH_OPTIMIZE_CACHE_SIZE = 32;    // Simulated post-transform cache, in vertices.
+
+// Average cache misses per triangle with a FIFO cache of cacheSize vertices. 3 is the worst, 0.5 the ideal for large grids.
+static f32
+MeshACMR(const std::vector<u32>& indices, u32 vertexCount, u32 cacheSize = MESH_OPTIMIZE_CACHE_SIZE)
+{
+    if (indices.size() < 3)
+    {
+        return 0;
+    }
+
+    // A vertex is cached when it was last loaded less than cacheSize misses ago
+    std::vector<u32> loadedAt(vertexCount, 0);
+    u32 misses = 0;
+    for (u32 index : indices)
+    {
+        if (loadedAt[index] == 0 || misses + 1 - loadedAt[index] >= cacheSize)
+        {
+            ++misses;
+            loadedAt[index] = misses;
+        }
+    }
+    return static_cast<f32>(misses) / (indices.size() / 3);
+}
+
+static f32
+ForsythVertexScore(i32 cachePosition, u32 remainingTriangles)
+{
+    if (remainingTriangles == 0)
+    {
+        return -1.0f;
+    }
+
+    f32 score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+        {
+            // The last triangle's vertices get a fixed score so it isn't simply repeated
+            score = 0.75f;
+        }
+        else
+        {
+            f32 scale = 1.0f / (MESH_OPTIMIZE_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, 1.5f);
+        }
+    }
+
+    // Vertices with few triangles left get finished off early
+    return score + 2.0f / std::sqrt(static_cast<f32>(remainingTriangles));
+}
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation". Leaves the order alone when it doesn't improve it.
+static void
+OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount)
+{
+    u32 triangleCount = static_cast<u32>(indices.size() / 3);
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Triangles of every vertex
+    std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+    for (u32 index : indices) ++adjacencyOffsets[index + 1];
+    for (u32 v = 0; v < vertexCount; ++v) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    std::vector<u32> adjacency(indices.size());
+    std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (u32 i = 0; i < indices.size(); ++i) adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<u32> remaining(vertexCount);
+    std::vector<i32> cachePosition(vertexCount, -1);
+    std::vector<f32> vertexScore(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+    {
+        remaining[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+        vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+    }
+
+    std::vector<f32> triangleScore(triangleCount);
+    std::vector<u8> emitted(triangleCount, 0);
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<u32> cache;
+    std::vector<u32> nextCache;
+    cache.reserve(MESH_OPTIMIZE_CACHE_SIZE + 3);
+    nextCache.reserve(MESH_OPTIMIZE_CACHE_SIZE + 3);
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    u32 scanCursor = 0;
+    i64 bestTriangle = -1;
+    for (u32 emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+    {
+        // Nothing in the cache leads anywhere, start over from the first triangle left
+        if (bestTriangle < 0)
+        {
+            while (emitted[scanCursor]) ++scanCursor;
+            bestTriangle = scanCursor;
+        }
+
+        u32 t = static_cast<u32>(bestTriangle);
+        emitted[t] = 1;
+        const u32 corners[3] = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+        for (u32 v : corners)
+        {
+            result.push_back(v);
+
+            // Drop the triangle from the vertex's list of remaining ones
+            u32 *first = &adjacency[adjacencyOffsets[v]];
+            u32 *last = first + remaining[v];
+            *std::find(first, last, t) = *(last - 1);
+            --remaining[v];
+        }
+
+        // LRU: the triangle's vertices move to the front
+        nextCache.assign(corners, corners + 3);
+        for (u32 v : cache)
+        {
+            if (v != corners[0] && v != corners[1] && v != corners[2])
+            {
+                nextCache.push_back(v);
+            }
+        }
+        for (size_t i = MESH_OPTIMIZE_CACHE_SIZE; i < nextCache.size(); ++i)
+        {
+            cachePosition[nextCache[i]] = -1;
+            vertexScore[nextCache[i]] = ForsythVertexScore(-1, remaining[nextCache[i]]);
+        }
+        nextCache.resize(std::min<size_t>(nextCache.size(), MESH_OPTIMIZE_CACHE_SIZE));
+        cache.swap(nextCache);
+
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            cachePosition[cache[i]] = static_cast<i32>(i);
+            vertexScore[cache[i]] = ForsythVertexScore(static_cast<i32>(i), remaining[cache[i]]);
+        }
+
+        // Only triangles touching the cache changed score
+        bestTriangle = -1;
+        f32 bestScore = -1.0f;
+        for (u32 v : cache)
+        {
+            for (u32 i = adjacencyOffsets[v]; i < adjacencyOffsets[v] + remaining[v]; ++i)
+            {
+                u32 candidate = adjacency[i];
+                f32 score = vertexScore[indices[candidate * 3]] + vertexScore[indices[candidate * 3 + 1]] + vertexScore[indices[candidate * 3 + 2]];
+                triangleScore[candidate] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = candidate;
+                }
+            }
+        }
+    }
+
+    // Meshes that come in strip order (like grids of patches) can already beat the greedy pick
+    if (MeshACMR(result, vertexCount) < MeshACMR(indices, vertexCount))
+    {
+        indices.swap(result);
+    }
+}
+
+/*
+Cuts the triangles into clusters wherever the simulated cache misses all three vertices of a
+triangle (the cache order restarts there anyway), then sorts the clusters by how much they face
+away from the center of the mesh. Outer surfaces get drawn first and hide the inner ones.
+(Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+*/
+template <typename Vertex>
+static void
+OptimizeOverdraw(std::vector<u32>& indices, const std::vector<Vertex>& vertices)
+{
+    u32 triangleCount = static_cast<u32>(indices.size() / 3);
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    std::vector<u32> clusterStarts;
+    std::vector<u32> loadedAt(vertices.size(), 0);
+    u32 misses = 0;
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        u32 triangleMisses = 0;
+        for (u32 corner = 0; corner < 3; ++corner)
+        {
+            u32 v = indices[t * 3 + corner];
+            if (loadedAt[v] == 0 || misses + 1 - loadedAt[v] >= MESH_OPTIMIZE_CACHE_SIZE)
+            {
+                ++misses;
+                ++triangleMisses;
+                loadedAt[v] = misses;
+            }
+        }
+        if (t == 0 || triangleMisses == 3)
+        {
+            clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    vec3f meshCenter = {0, 0, 0};
+    for (const Vertex& v : vertices) meshCenter += v.point;
+    meshCenter /= static_cast<f32>(vertices.size());
+
+    struct overdraw_cluster
+    {
+        u32 first;
+        u32 count;
+        f32 sortKey;
+    };
+    std::vector<overdraw_cluster> clusters;
+    for (size_t c = 0; c + 1 < clusterStarts.size(); ++c)
+    {
+        // Area weighted centroid and normal of the cluster
+        vec3f centroid = {0, 0, 0};
+        vec3f normal = {0, 0, 0};
+        f32 area = 0;
+        for (u32 t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+        {
+            const vec3f& p0 = vertices[indices[t * 3]].point;
+            const vec3f& p1 = vertices[indices[t * 3 + 1]].point;
+            const vec3f& p2 = vertices[indices[t * 3 + 2]].point;
+            vec3f n = cross(p1 - p0, p2 - p0);
+            f32 a = length(n);
+            centroid += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        if (area > 0) centroid /= area;
+        f32 normalLength = length(normal);
+        if (normalLength > 0) normal /= normalLength;
+
+        clusters.push_back({clusterStarts[c], clusterStarts[c + 1] - clusterStarts[c], dot(centroid - meshCenter, normal)});
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const overdraw_cluster& a, const overdraw_cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<u32> result;
+    result.reserve(indices.size());
+    for (const overdraw_cluster& cluster : clusters)
+    {
+        result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + (cluster.first + cluster.count) * 3);
+    }
+    indices.swap(result);
+}
+
+// Renumbers vertices in the order the index buffer first uses them
+template <typename Vertex>
+static void
+OptimizeVertexFetch(std::vector<u32>& indices, std::vector<Vertex>& vertices)
+{
+    const u32 UNUSED = 0xFFFFFFFF;
+    std::vector<u32> remap(vertices.size(), UNUSED);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (u32& index : indices)
+    {
+        if (remap[index] == UNUSED)
+        {
+            remap[index] = static_cast<u32>(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(reordered);
+}
+
+#endif // MESH_OPTIMIZE_H
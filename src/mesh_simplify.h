@@ -0,0 +1,320 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+/*
+Quadric error mesh simplification (Garland and Heckbert, "Surface Simplification Using Quadric
+Error Metrics"), restricted to collapsing an edge onto one of its two vertices so every level of
+detail indexes the original vertex buffer.
+Vertices that share a position (normal seams) collapse together, each one onto the vertex of the
+target position with the closest normal, so the surface never tears open along a seam.
+*/
+
+/*
+88 bytes
+*/
+struct quadric
+{
+    // Symmetric 4x4 matrix summing squared distances to planes, weighted by triangle area
+    f64 a00, a01, a02, a11, a12, a22;
+    f64 b0, b1, b2;
+    f64 c;
+    f64 weight;
+};
+
+static inline void
+AddPlaneQuadric(quadric& Q, const vec3f& n, f32 d, f64 weight)
+{
+    Q.a00 += weight * n.x * n.x; Q.a01 += weight * n.x * n.y; Q.a02 += weight * n.x * n.z;
+    Q.a11 += weight * n.y * n.y; Q.a12 += weight * n.y * n.z; Q.a22 += weight * n.z * n.z;
+    Q.b0 += weight * n.x * d; Q.b1 += weight * n.y * d; Q.b2 += weight * n.z * d;
+    Q.c += weight * d * d;
+    Q.weight += weight;
+}
+
+static inline void
+AddQuadric(quadric& Q, const quadric& R)
+{
+    Q.a00 += R.a00; Q.a01 += R.a01; Q.a02 += R.a02;
+    Q.a11 += R.a11; Q.a12 += R.a12; Q.a22 += R.a22;
+    Q.b0 += R.b0; Q.b1 += R.b1; Q.b2 += R.b2;
+    Q.c += R.c;
+    Q.weight += R.weight;
+}
+
+// Area weighted mean of the squared distances from p to the planes summed in Q and R
+static inline f64
+QuadricError(const quadric& Q, const quadric& R, const vec3f& p)
+{
+    f64 a00 = Q.a00 + R.a00, a01 = Q.a01 + R.a01, a02 = Q.a02 + R.a02;
+    f64 a11 = Q.a11 + R.a11, a12 = Q.a12 + R.a12, a22 = Q.a22 + R.a22;
+    f64 error = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+              + 2 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+              + 2 * ((Q.b0 + R.b0) * p.x + (Q.b1 + R.b1) * p.y + (Q.b2 + R.b2) * p.z)
+              + Q.c + R.c;
+    f64 weight = Q.weight + R.weight;
+    return weight > 0 ? std::max(error, 0.0) / weight : 0.0;
+}
+
+const f32 SIMPLIFY_BOUNDARY_WEIGHT = 10.0f;  // Keeps open borders from shrinking.
+
+/*
+Usage: construct with the full mesh, then call Simplify with falling triangle targets. Every
+call continues from the last one, so the levels nest and their errors only grow.
+*/
+template <typename Vertex>
+class mesh_simplifier
+{
+private:
+    struct collapse
+    {
+        u32 from;       // Positions.
+        u32 to;
+        f64 cost;
+    };
+
+    const std::vector<Vertex>& vertices_;
+    std::vector<u32> indices_;              // Triangles left, into vertices_.
+    std::vector<u32> positionOf_;           // Position of every vertex.
+    std::vector<vec3f> positions_;
+    std::vector<u32> positionVertexOffsets_;// Vertices of every position, in positionVertices_.
+    std::vector<u32> positionVertices_;
+    std::vector<quadric> quadrics_;         // Per position.
+    f32 error_ = 0.0f;                      // Largest distance of a collapse so far.
+
+    // Rejects the collapse if a triangle around from would turn over or become a sliver
+    bool FlipsTriangles(u32 from, u32 to, const std::vector<u32>& triangleOffsets, const std::vector<u32>& triangles) const
+    {
+        for (u32 i = triangleOffsets[from]; i < triangleOffsets[from + 1]; ++i)
+        {
+            const u32 *t = &indices_[triangles[i] * 3];
+            u32 p[3] = { positionOf_[t[0]], positionOf_[t[1]], positionOf_[t[2]] };
+            if (p[0] == to || p[1] == to || p[2] == to)
+            {
+                continue; // Goes away with the collapse
+            }
+
+            vec3f before = cross(positions_[p[1]] - positions_[p[0]], positions_[p[2]] - positions_[p[0]]);
+            for (u32& corner : p) corner = corner == from ? to : corner;
+            vec3f after = cross(positions_[p[1]] - positions_[p[0]], positions_[p[2]] - positions_[p[0]]);
+            if (dot(before, after) <= 0.25f * length(before) * length(after))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The vertex of position to whose normal is closest to vertex's
+    u32 ClosestVertex(u32 vertex, u32 to) const
+    {
+        u32 closest = positionVertices_[positionVertexOffsets_[to]];
+        f32 closestDot = -2.0f;
+        for (u32 i = positionVertexOffsets_[to]; i < positionVertexOffsets_[to + 1]; ++i)
+        {
+            f32 d = dot(vertices_[positionVertices_[i]].normal, vertices_[vertex].normal);
+            if (d > closestDot)
+            {
+                closestDot = d;
+                closest = positionVertices_[i];
+            }
+        }
+        return closest;
+    }
+
+public:
+    mesh_simplifier(const std::vector<Vertex>& vertices, const std::vector<u32>& indices)
+        : vertices_{vertices}, indices_{indices}
+    {
+        // Positions by value, the welded vertices repeat them along normal seams
+        std::vector<u32> sorted(vertices.size());
+        for (u32 v = 0; v < vertices.size(); ++v) sorted[v] = v;
+        auto less = [&](u32 a, u32 b)
+        {
+            const vec3f& p = vertices[a].point;
+            const vec3f& q = vertices[b].point;
+            return p.x < q.x || (p.x == q.x && (p.y < q.y || (p.y == q.y && p.z < q.z)));
+        };
+        std::sort(sorted.begin(), sorted.end(), less);
+        positionOf_.resize(vertices.size());
+        for (u32 i = 0; i < sorted.size(); ++i)
+        {
+            if (i == 0 || less(sorted[i - 1], sorted[i]))
+            {
+                positions_.push_back(vertices[sorted[i]].point);
+            }
+            positionOf_[sorted[i]] = static_cast<u32>(positions_.size() - 1);
+        }
+
+        u32 positionCount = static_cast<u32>(positions_.size());
+        positionVertexOffsets_.assign(positionCount + 1, 0);
+        for (u32 p : positionOf_) ++positionVertexOffsets_[p + 1];
+        for (u32 p = 0; p < positionCount; ++p) positionVertexOffsets_[p + 1] += positionVertexOffsets_[p];
+        positionVertices_.resize(vertices.size());
+        std::vector<u32> fill(positionVertexOffsets_.begin(), positionVertexOffsets_.end() - 1);
+        for (u32 v = 0; v < vertices.size(); ++v) positionVertices_[fill[positionOf_[v]]++] = v;
+
+        // Triangles without area in position space have no edge worth collapsing
+        u32 kept = 0;
+        for (size_t t = 0; t < indices_.size() / 3; ++t)
+        {
+            u32 p0 = positionOf_[indices_[t * 3]], p1 = positionOf_[indices_[t * 3 + 1]], p2 = positionOf_[indices_[t * 3 + 2]];
+            if (p0 != p1 && p1 != p2 && p0 != p2)
+            {
+                std::copy(&indices_[t * 3], &indices_[t * 3] + 3, &indices_[kept * 3]);
+                ++kept;
+            }
+        }
+        indices_.resize(kept * 3);
+
+        // Triangle planes, and for edges only one triangle uses a plane through the edge standing
+        // up from the triangle, so the collapses keep the border in place
+        quadrics_.assign(positionCount, quadric{});
+        std::unordered_map<u64, i32> edgeUses;
+        for (size_t t = 0; t < indices_.size() / 3; ++t)
+        {
+            u32 p[3] = { positionOf_[indices_[t * 3]], positionOf_[indices_[t * 3 + 1]], positionOf_[indices_[t * 3 + 2]] };
+            vec3f n = cross(positions_[p[1]] - positions_[p[0]], positions_[p[2]] - positions_[p[0]]);
+            f32 doubleArea = length(n);
+            if (doubleArea > 0)
+            {
+                n /= doubleArea;
+                for (u32 corner : p) AddPlaneQuadric(quadrics_[corner], n, -dot(n, positions_[p[0]]), 0.5 * doubleArea);
+            }
+            for (u32 e = 0; e < 3; ++e)
+            {
+                u32 a = std::min(p[e], p[(e + 1) % 3]);
+                u32 b = std::max(p[e], p[(e + 1) % 3]);
+                ++edgeUses[(static_cast<u64>(a) << 32) | b];
+            }
+        }
+        for (size_t t = 0; t < indices_.size() / 3; ++t)
+        {
+            u32 p[3] = { positionOf_[indices_[t * 3]], positionOf_[indices_[t * 3 + 1]], positionOf_[indices_[t * 3 + 2]] };
+            vec3f n = cross(positions_[p[1]] - positions_[p[0]], positions_[p[2]] - positions_[p[0]]);
+            for (u32 e = 0; e < 3; ++e)
+            {
+                u32 a = p[e];
+                u32 b = p[(e + 1) % 3];
+                if (edgeUses[(static_cast<u64>(std::min(a, b)) << 32) | std::max(a, b)] != 1)
+                {
+                    continue;
+                }
+                vec3f edge = positions_[b] - positions_[a];
+                vec3f border = cross(edge, n);
+                f32 borderLength = length(border);
+                if (borderLength > 0)
+                {
+                    border /= borderLength;
+                    f64 weight = SIMPLIFY_BOUNDARY_WEIGHT * length_squared(edge);
+                    AddPlaneQuadric(quadrics_[a], border, -dot(border, positions_[a]), weight);
+                    AddPlaneQuadric(quadrics_[b], border, -dot(border, positions_[a]), weight);
+                }
+            }
+        }
+    }
+
+    const std::vector<u32>& Indices() const { return indices_; }
+
+    // Largest distance from the original surface any collapse so far introduced, in model units
+    f32 Error() const { return error_; }
+
+    /*
+    Collapses the cheapest edges until at most targetTriangles are left. Stops early when every
+    remaining collapse would turn a triangle over.
+    Works in passes: a collapse locks the neighbourhood of its vertex, so the collapses of one pass
+    never touch the same triangles and all of them can be checked against the same geometry.
+    */
+    void Simplify(u32 targetTriangles)
+    {
+        u32 positionCount = static_cast<u32>(positions_.size());
+        std::vector<u32> triangleOffsets(positionCount + 1);
+        std::vector<u32> triangles;
+        std::vector<collapse> collapses;
+        std::vector<u8> locked(positionCount);
+        std::vector<u32> vertexRemap(vertices_.size());
+
+        while (indices_.size() / 3 > targetTriangles)
+        {
+            u32 triangleCount = static_cast<u32>(indices_.size() / 3);
+
+            // Triangles around every position
+            std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+            for (u32 index : indices_) ++triangleOffsets[positionOf_[index] + 1];
+            for (u32 p = 0; p < positionCount; ++p) triangleOffsets[p + 1] += triangleOffsets[p];
+            triangles.resize(indices_.size());
+            std::vector<u32> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (u32 i = 0; i < indices_.size(); ++i) triangles[fill[positionOf_[indices_[i]]]++] = i / 3;
+
+            // Every edge in its cheaper direction. Interior edges come up once from each of their
+            // triangles, the second copy always finds its positions locked.
+            collapses.clear();
+            for (u32 t = 0; t < triangleCount; ++t)
+            {
+                for (u32 e = 0; e < 3; ++e)
+                {
+                    u32 a = positionOf_[indices_[t * 3 + e]];
+                    u32 b = positionOf_[indices_[t * 3 + (e + 1) % 3]];
+                    f64 toB = QuadricError(quadrics_[a], quadrics_[b], positions_[b]);
+                    f64 toA = QuadricError(quadrics_[a], quadrics_[b], positions_[a]);
+                    collapses.push_back(toB <= toA ? collapse{a, b, toB} : collapse{b, a, toA});
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const collapse& x, const collapse& y) { return x.cost < y.cost; });
+
+            // An interior collapse removes two triangles
+            u32 wanted = std::max<u32>((triangleCount - targetTriangles + 1) / 2, 1);
+            u32 done = 0;
+            std::fill(locked.begin(), locked.end(), 0);
+            for (u32 v = 0; v < vertexRemap.size(); ++v) vertexRemap[v] = v;
+            for (const collapse& c : collapses)
+            {
+                if (done >= wanted) break;
+                if (locked[c.from] || locked[c.to]) continue;
+                if (FlipsTriangles(c.from, c.to, triangleOffsets, triangles)) continue;
+
+                for (u32 i = triangleOffsets[c.from]; i < triangleOffsets[c.from + 1]; ++i)
+                {
+                    const u32 *t = &indices_[triangles[i] * 3];
+                    locked[positionOf_[t[0]]] = locked[positionOf_[t[1]]] = locked[positionOf_[t[2]]] = 1;
+                }
+                for (u32 i = positionVertexOffsets_[c.from]; i < positionVertexOffsets_[c.from + 1]; ++i)
+                {
+                    u32 vertex = positionVertices_[i];
+                    vertexRemap[vertex] = ClosestVertex(vertex, c.to);
+                }
+                AddQuadric(quadrics_[c.to], quadrics_[c.from]);
+                error_ = std::max(error_, static_cast<f32>(std::sqrt(c.cost)));
+                ++done;
+            }
+            if (done == 0)
+            {
+                break;
+            }
+
+            // Triangles that lost a corner in a collapse are gone
+            u32 kept = 0;
+            for (u32 t = 0; t < triangleCount; ++t)
+            {
+                u32 v0 = vertexRemap[indices_[t * 3]];
+                u32 v1 = vertexRemap[indices_[t * 3 + 1]];
+                u32 v2 = vertexRemap[indices_[t * 3 + 2]];
+                if (positionOf_[v0] == positionOf_[v1] || positionOf_[v1] == positionOf_[v2] || positionOf_[v0] == positionOf_[v2])
+                {
+                    continue;
+                }
+                indices_[kept * 3] = v0;
+                indices_[kept * 3 + 1] = v1;
+                indices_[kept * 3 + 2] = v2;
+                ++kept;
+            }
+            indices_.resize(kept * 3);
+        }
+    }
+};
+
+#endif // MESH_SIMPLIFY_H
@@ -0,0 +1,61 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/*
+Lock-free queue for any number of producer threads and a single consumer. Push links a node in
+with a compare-and-swap, the consumer takes the whole list with one exchange, so neither side
+ever blocks the other. Meant for low rates like handing finished work back to the render thread.
+*/
+template <typename T>
+class mpsc_queue
+{
+private:
+    struct node
+    {
+        T value;
+        node *next;
+    };
+
+    std::atomic<node *> head_;     // Most recently pushed node.
+
+public:
+    mpsc_queue() : head_{nullptr} {}
+    ~mpsc_queue()
+    {
+        std::vector<T> leftover;
+        PopAll(leftover);
+    }
+
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+    // Any thread
+    void Push(const T& value)
+    {
+        node *pushed = new node{value, head_.load(std::memory_order_relaxed)};
+        while (!head_.compare_exchange_weak(pushed->next, pushed, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Consumer thread only. Appends everything pushed so far to out, oldest first.
+    void PopAll(std::vector<T>& out)
+    {
+        node *taken = head_.exchange(nullptr, std::memory_order_acquire);
+        size_t first = out.size();
+        while (taken != nullptr)
+        {
+            out.push_back(taken->value);
+            node *next = taken->next;
+            delete taken;
+            taken = next;
+        }
+        std::reverse(out.begin() + first, out.end());
+    }
+};
+
+#endif // MPSC_QUEUE_H
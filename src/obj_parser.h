@@ -0,0 +1,479 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/*
+Tokenizes OBJ text in place. Works on a memory range (normally a mapped_file) with hand-written
+number parsing, so the only allocations are the amortized growth of the output vectors.
+
+Only v, vn and f lines are read, everything else is skipped. Face indices are kept 1-based like
+in the file, negative (relative) indices are resolved against the elements read before them.
+Large files are cut into line-aligned chunks that are parsed on a worker_pool and merged.
+*/
+struct obj_data
+{
+    std::vector<vec3f> vertices;
+    std::vector<vec3f> normals;
+    std::vector<i32> vertexIndices;
+    std::vector<i32> normalIndices;
+
+    // Slots of vertexIndices and normalIndices that came from relative indices. They are resolved
+    // within the chunk, so the merge adds the elements of the chunks before it.
+    std::vector<u32> relativeVertexSlots;
+    std::vector<u32> relativeNormalSlots;
+
+    // Scratch for the face being parsed, kept around so faces don't allocate
+    std::vector<i32> faceVertexIndices;
+    std::vector<i32> faceNormalIndices;
+    std::vector<i32> faceRelativeVertexCorners;
+    std::vector<i32> faceRelativeNormalCorners;
+
+    u32 errors;             // Lines with numbers that couldn't be parsed, they are skipped.
+    u32 largePolygons;      // Faces with more than 4 vertices, fanned into triangles.
+};
+
+static inline bool
+ObjIsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool
+ObjIsDigit(char c)
+{
+    return static_cast<u32>(c - '0') < 10;
+}
+
+static inline const char *
+ObjSkipSpaces(const char *at, const char *end)
+{
+    while (at < end && ObjIsSpace(*at)) ++at;
+    return at;
+}
+
+static inline const char *
+ObjSkipLine(const char *at, const char *end)
+{
+    while (at < end && *at != '\n') ++at;
+    return at < end ? at + 1 : end;
+}
+
+// Returns the character after the number, or nullptr when there are no digits at at
+static const char *
+ObjParseInt(const char *at, const char *end, i32 *value)
+{
+    bool negative = false;
+    if (at < end && (*at == '-' || *at == '+'))
+    {
+        negative = *at == '-';
+        ++at;
+    }
+
+    if (at == end || !ObjIsDigit(*at))
+    {
+        return nullptr;
+    }
+
+    // Saturates, so a long digit run can't overflow; it still ends up out of every index range
+    i64 result = 0;
+    while (at < end && ObjIsDigit(*at))
+    {
+        result = std::min<i64>(result * 10 + (*at - '0'), std::numeric_limits<i32>::max());
+        ++at;
+    }
+
+    *value = static_cast<i32>(negative ? -result : result);
+    return at;
+}
+
+/*
+Decimal and exponent forms. The first 19 significant digits are accumulated exactly in an
+integer and scaled by powers of ten in double precision. Rounding that to float again can be
+off by one ulp from strtof, which doesn't show in a mesh. The exponent is clamped while
+it accumulates; past 10^400 every f32 is already inf or 0, and the scaling loops stay short.
+*/
+static const char *
+ObjParseFloat(const char *at, const char *end, f32 *value)
+{
+    const i32 MAX_EXPONENT = 400;
+    static const f64 POWERS_OF_TEN[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool negative = false;
+    if (at < end && (*at == '-' || *at == '+'))
+    {
+        negative = *at == '-';
+        ++at;
+    }
+
+    u64 mantissa = 0;
+    i32 digits = 0;
+    i32 exponent = 0;
+    bool anyDigits = false;
+
+    while (at < end && ObjIsDigit(*at))
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*at - '0');
+            digits += mantissa != 0;
+        }
+        else if (exponent < MAX_EXPONENT)
+        {
+            ++exponent;
+        }
+        anyDigits = true;
+        ++at;
+    }
+
+    if (at < end && *at == '.')
+    {
+        ++at;
+        while (at < end && ObjIsDigit(*at))
+        {
+            if (digits < 19 && exponent > -MAX_EXPONENT)
+            {
+                mantissa = mantissa * 10 + (*at - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+            anyDigits = true;
+            ++at;
+        }
+    }
+
+    if (!anyDigits)
+    {
+        return nullptr;
+    }
+
+    if (at < end && (*at == 'e' || *at == 'E'))
+    {
+        const char *after = at + 1;
+        bool negativeExponent = false;
+        if (after < end && (*after == '-' || *after == '+'))
+        {
+            negativeExponent = *after == '-';
+            ++after;
+        }
+
+        if (after < end && ObjIsDigit(*after))
+        {
+            i32 written = 0;
+            while (after < end && ObjIsDigit(*after))
+            {
+                written = std::min(written * 10 + (*after - '0'), 2 * MAX_EXPONENT);
+                ++after;
+            }
+            exponent += negativeExponent ? -written : written;
+            exponent = std::max(-MAX_EXPONENT, std::min(exponent, MAX_EXPONENT));
+            at = after;
+        }
+    }
+
+    f64 result = static_cast<f64>(mantissa);
+    while (exponent > 22)
+    {
+        result *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22)
+    {
+        result /= 1e22;
+        exponent += 22;
+    }
+    result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+
+    *value = static_cast<f32>(negative ? -result : result);
+    return at;
+}
+
+static const char *
+ObjParseVec3(const char *at, const char *end, vec3f *vec)
+{
+    f32 values[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        at = ObjParseFloat(ObjSkipSpaces(at, end), end, &values[i]);
+        if (at == nullptr)
+        {
+            return nullptr;
+        }
+    }
+    *vec = {values[0], values[1], values[2]};
+    return at;
+}
+
+// OBJ indices are 1-based, negative ones count back from the last element read
+static inline i32
+ObjResolveIndex(i32 index, size_t count)
+{
+    return index < 0 ? static_cast<i32>(count) + 1 + index : index;
+}
+
+// Parses the corners of a face line ("v", "v/t", "v//n" or "v/t/n") into data's scratch vectors
+static const char *
+ObjParseFace(const char *at, const char *end, obj_data& data)
+{
+    data.faceVertexIndices.clear();
+    data.faceNormalIndices.clear();
+    data.faceRelativeVertexCorners.clear();
+    data.faceRelativeNormalCorners.clear();
+
+    for (;;)
+    {
+        at = ObjSkipSpaces(at, end);
+        if (at == end || *at == '\n' || *at == '#')
+        {
+            return at;
+        }
+
+        i32 index;
+        at = ObjParseInt(at, end, &index);
+        if (at == nullptr)
+        {
+            return nullptr;
+        }
+        if (index < 0)
+        {
+            data.faceRelativeVertexCorners.push_back(static_cast<i32>(data.faceVertexIndices.size()));
+        }
+        data.faceVertexIndices.push_back(ObjResolveIndex(index, data.vertices.size()));
+
+        if (at < end && *at == '/')
+        {
+            ++at;
+            // Texture coordinates are not used
+            while (at < end && (ObjIsDigit(*at) || *at == '-')) ++at;
+
+            if (at < end && *at == '/')
+            {
+                at = ObjParseInt(at + 1, end, &index);
+                if (at == nullptr)
+                {
+                    return nullptr;
+                }
+                if (index < 0)
+                {
+                    data.faceRelativeNormalCorners.push_back(static_cast<i32>(data.faceNormalIndices.size()));
+                }
+                data.faceNormalIndices.push_back(ObjResolveIndex(index, data.normals.size()));
+            }
+        }
+
+        if (at < end && !ObjIsSpace(*at) && *at != '\n')
+        {
+            return nullptr;
+        }
+    }
+}
+
+// Adds the slots that a fan starting at firstSlot writes the given face corners to
+static void
+ObjRecordRelativeSlots(const std::vector<i32>& corners, i32 cornerCount, u32 firstSlot, std::vector<u32>& slots)
+{
+    for (i32 corner : corners)
+    {
+        for (i32 i = 1; i < cornerCount - 1; ++i)
+        {
+            u32 triangleSlot = firstSlot + (i - 1) * 3;
+            if (corner == 0) slots.push_back(triangleSlot);
+            if (corner == i) slots.push_back(triangleSlot + 1);
+            if (corner == i + 1) slots.push_back(triangleSlot + 2);
+        }
+    }
+}
+
+// Triangulates the face in data's scratch vectors: quads are split into 1, 2, 3 and 1, 3, 4, larger polygons fanned
+static void
+ObjEmitFace(obj_data& data)
+{
+    const std::vector<i32>& face = data.faceVertexIndices;
+    const std::vector<i32>& faceNormals = data.faceNormalIndices;
+    size_t corners = face.size();
+    if (corners < 3)
+    {
+        return;
+    }
+
+    if (corners > 4)
+    {
+        ++data.largePolygons;
+    }
+
+    bool hasNormals = faceNormals.size() == corners;
+    if (!data.faceRelativeVertexCorners.empty())
+    {
+        ObjRecordRelativeSlots(data.faceRelativeVertexCorners, static_cast<i32>(corners),
+                               static_cast<u32>(data.vertexIndices.size()), data.relativeVertexSlots);
+    }
+    if (hasNormals && !data.faceRelativeNormalCorners.empty())
+    {
+        ObjRecordRelativeSlots(data.faceRelativeNormalCorners, static_cast<i32>(corners),
+                               static_cast<u32>(data.normalIndices.size()), data.relativeNormalSlots);
+    }
+
+    for (size_t i = 1; i < corners - 1; ++i)
+    {
+        data.vertexIndices.push_back(face[0]);
+        data.vertexIndices.push_back(face[i]);
+        data.vertexIndices.push_back(face[i + 1]);
+
+        if (hasNormals)
+        {
+            data.normalIndices.push_back(faceNormals[0]);
+            data.normalIndices.push_back(faceNormals[i]);
+            data.normalIndices.push_back(faceNormals[i + 1]);
+        }
+    }
+}
+
+static void
+ParseOBJChunk(const char *begin, const char *end, obj_data& data)
+{
+    data.errors = 0;
+    data.largePolygons = 0;
+
+    const char *at = begin;
+    while (at < end)
+    {
+        at = ObjSkipSpaces(at, end);
+        const char *lineStart = at;
+        bool parsed = true;
+
+        if (end - at > 1 && at[0] == 'v' && ObjIsSpace(at[1]))
+        {
+            vec3f vec;
+            at = ObjParseVec3(at + 2, end, &vec);
+            if (at != nullptr)
+            {
+                data.vertices.push_back(vec);
+            }
+            parsed = at != nullptr;
+        }
+        else if (end - at > 2 && at[0] == 'v' && at[1] == 'n' && ObjIsSpace(at[2]))
+        {
+            vec3f vec;
+            at = ObjParseVec3(at + 3, end, &vec);
+            if (at != nullptr)
+            {
+                data.normals.push_back(vec);
+            }
+            parsed = at != nullptr;
+        }
+        else if (end - at > 1 && at[0] == 'f' && ObjIsSpace(at[1]))
+        {
+            at = ObjParseFace(at + 2, end, data);
+            if (at != nullptr)
+            {
+                ObjEmitFace(data);
+            }
+            parsed = at != nullptr;
+        }
+
+        if (!parsed)
+        {
+            ++data.errors;
+            at = lineStart;
+        }
+        at = ObjSkipLine(at, end);
+    }
+}
+
+const size_t OBJ_CHUNK_BYTES = 256 * 1024;    // Files smaller than two chunks are parsed on the calling thread.
+
+/*
+Parses [begin, end) into data. With workers, the text is cut into line-aligned chunks that are
+parsed in parallel into their own obj_data, then copied into data in file order while the
+relative indices of every chunk are offset by the elements of the chunks before it.
+*/
+static void
+ParseOBJ(const char *begin, const char *end, obj_data& data, worker_pool *workers = nullptr)
+{
+    size_t size = end - begin;
+    size_t chunkCount = 1;
+    if (workers != nullptr && workers->ThreadCount() > 1)
+    {
+        chunkCount = std::min(static_cast<size_t>(workers->ThreadCount()) * 4, size / OBJ_CHUNK_BYTES);
+    }
+
+    if (chunkCount <= 1)
+    {
+        ParseOBJChunk(begin, end, data);
+        return;
+    }
+
+    // A cut that lands mid-line moves to the start of the next line
+    std::vector<const char *> bounds(chunkCount + 1);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunkCount; ++i)
+    {
+        bounds[i] = ObjSkipLine(std::max(begin + size * i / chunkCount, bounds[i - 1]), end);
+    }
+    bounds[chunkCount] = end;
+
+    std::vector<obj_data> chunks(chunkCount);
+    workers->ParallelFor(static_cast<i32>(chunkCount), [&](i32 chunk)
+    {
+        ParseOBJChunk(bounds[chunk], bounds[chunk + 1], chunks[chunk]);
+    });
+
+    // Where every chunk's elements start in the merged arrays
+    struct chunk_offsets
+    {
+        size_t vertices;
+        size_t normals;
+        size_t vertexIndices;
+        size_t normalIndices;
+    };
+    std::vector<chunk_offsets> offsets(chunkCount + 1);
+    offsets[0] = {};
+    data.errors = 0;
+    data.largePolygons = 0;
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        offsets[i + 1].vertices = offsets[i].vertices + chunks[i].vertices.size();
+        offsets[i + 1].normals = offsets[i].normals + chunks[i].normals.size();
+        offsets[i + 1].vertexIndices = offsets[i].vertexIndices + chunks[i].vertexIndices.size();
+        offsets[i + 1].normalIndices = offsets[i].normalIndices + chunks[i].normalIndices.size();
+        data.errors += chunks[i].errors;
+        data.largePolygons += chunks[i].largePolygons;
+    }
+
+    const chunk_offsets& total = offsets[chunkCount];
+    data.vertices.resize(total.vertices);
+    data.normals.resize(total.normals);
+    data.vertexIndices.resize(total.vertexIndices);
+    data.normalIndices.resize(total.normalIndices);
+    data.relativeVertexSlots.clear();
+    data.relativeNormalSlots.clear();
+
+    workers->ParallelFor(static_cast<i32>(chunkCount), [&](i32 chunk)
+    {
+        obj_data& parsed = chunks[chunk];
+        const chunk_offsets& offset = offsets[chunk];
+        for (u32 slot : parsed.relativeVertexSlots)
+        {
+            parsed.vertexIndices[slot] += static_cast<i32>(offset.vertices);
+        }
+        for (u32 slot : parsed.relativeNormalSlots)
+        {
+            parsed.normalIndices[slot] += static_cast<i32>(offset.normals);
+        }
+
+        std::copy(parsed.vertices.begin(), parsed.vertices.end(), data.vertices.begin() + offset.vertices);
+        std::copy(parsed.normals.begin(), parsed.normals.end(), data.normals.begin() + offset.normals);
+        std::copy(parsed.vertexIndices.begin(), parsed.vertexIndices.end(), data.vertexIndices.begin() + offset.vertexIndices);
+        std::copy(parsed.normalIndices.begin(), parsed.normalIndices.end(), data.normalIndices.begin() + offset.normalIndices);
+    });
+}
+
+#endif // OBJ_PARSER_H
@@ -1,10 +1,18 @@
 #ifndef OBJECT3D_H
 #define OBJECT3D_H
 
+#include "mapped_file.h"
+#include "mesh_optimize.h"
+#include "mesh_simplify.h"
+#include "obj_parser.h"
+
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
-#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <filesystem>
 
 // NOTE: The obj loader in this rasterizer does not support:
@@ -25,6 +33,85 @@ struct vertex3
     color4 color;
 };
 
+/*
+10 bytes
+*/
+struct packed_vertex
+{
+    i16 position[3];    // Inside the model's bounding sphere, see PackPosition.
+    i16 normal[2];      // Octahedral, see PackNormal.
+};
+
+static inline i16
+PackSnorm16(f32 value)
+{
+    value = std::min(std::max(value, -1.0f), 1.0f);
+    return static_cast<i16>(std::lround(value * 32767.0f));
+}
+
+// The position relative to the sphere, in 1/32767ths of its radius on every axis
+static inline void
+PackPosition(const vec3f& point, const sphere& bounds, i16 packed[3])
+{
+    vec3f relative = (point - bounds.center) / bounds.radius;
+    packed[0] = PackSnorm16(relative.x);
+    packed[1] = PackSnorm16(relative.y);
+    packed[2] = PackSnorm16(relative.z);
+}
+
+static inline vec3f
+PackedPositionVector(const packed_vertex& packed)
+{
+    return {static_cast<f32>(packed.position[0]), static_cast<f32>(packed.position[1]), static_cast<f32>(packed.position[2])};
+}
+
+// Takes PackedPositionVector back into model space, meant to be folded into the model-view matrix
+static inline mat4x4
+UnpackPositionMatrix(const sphere& bounds)
+{
+    f32 scale = bounds.radius / 32767.0f;
+    return
+    {
+        vec4f{scale, 0, 0, 0},
+        vec4f{0, scale, 0, 0},
+        vec4f{0, 0, scale, 0},
+        vec4f{bounds.center.x, bounds.center.y, bounds.center.z, 1}
+    };
+}
+
+/*
+Octahedral normal encoding: the unit normal is projected onto the octahedron |x| + |y| + |z| = 1,
+whose lower half is folded over the upper one, leaving two coordinates in [-1, 1]. At 16 bits
+each the error stays around a hundredth of a degree.
+*/
+static inline void
+PackNormal(const vec3f& normal, i16 packed[2])
+{
+    f32 sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    f32 x = sum > 0 ? normal.x / sum : 0.0f;
+    f32 y = sum > 0 ? normal.y / sum : 0.0f;
+    if (normal.z < 0)
+    {
+        f32 foldedX = (1.0f - std::fabs(y)) * (x >= 0 ? 1.0f : -1.0f);
+        f32 foldedY = (1.0f - std::fabs(x)) * (y >= 0 ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    packed[0] = PackSnorm16(x);
+    packed[1] = PackSnorm16(y);
+}
+
+static inline vec3f
+UnpackNormal(const i16 packed[2])
+{
+    vec3f normal = {packed[0] / 32767.0f, packed[1] / 32767.0f, 0.0f};
+    normal.z = 1.0f - std::fabs(normal.x) - std::fabs(normal.y);
+    f32 fold = std::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0 ? -fold : fold;
+    normal.y += normal.y >= 0 ? -fold : fold;
+    return normalize(normal);
+}
+
 inline std::ostream&
 operator<<(std::ostream& o, const vertex3& v)
 {
@@ -33,40 +120,237 @@ operator<<(std::ostream& o, const vertex3& v)
 }
 
 /*
+A cluster of up to MESHLET_MAX_TRIANGLES neighbouring triangles with bounds for culling it
+before any of its vertices are transformed.
+
 40 bytes
 */
+struct model_meshlet
+{
+    sphere bounds;      // In model space.
+    vec3f coneAxis;     // Average facing of the triangles.
+    f32 coneCutoff;     // Sine of the widest angle between coneAxis and a triangle, 1 when too wide to ever cull.
+    u32 firstIndex;     // Into the model's index buffer.
+    u32 triangleCount;
+};
+
+/*
+One level of detail: a range of the model's index buffer, cut into a range of its meshlets.
+
+20 bytes
+*/
+struct model_lod
+{
+    u32 firstIndex;
+    u32 indexCount;
+    u32 firstMeshlet;
+    u32 meshletCount;
+    f32 error;          // Largest distance from the full mesh, in model units.
+};
+
+const u32 MAX_MODEL_LODS = 8;
+
+/*
+232 bytes
+*/
 struct Model3D
 {
-    // These form a vertex3
-    vec3f *VertexPositions;
-    vec3f *vertexNormals;
-    color4 *VertexColors;
+    vertex3 *Vertices;  // Interleaved, every distinct position and normal pair of the mesh once. nullptr while packed.
+
+    // Three per triangle, into Vertices. Only one of them is set, see ModelIndexSize.
+    // Holds every level of detail, finest first.
+    u16 *Indices16;
+    u32 *Indices32;
+    model_meshlet *Meshlets;    // Of every level of detail, see BuildModelMeshlets.
+
+    // Compact storage, see PackModel. Only set while the model is packed.
+    packed_vertex *PackedVertices;
+    color4 *PackedColors;   // nullptr when every vertex has UniformColor.
 
-    // These form triangles
-    i32 *vertexIndices;
-    i32 *normalIndices;
+    sphere BoundingSphere;  // In model space.
 
     u32 vn;  // vertex count
-    u32 in;  // index count
+    u32 in;  // index count, of all levels together
+    u32 meshletCount;
+    u32 refCount;  // Objects sharing this model, see AcquireModel and ReleaseModel
+    color4 UniformColor;
+
+    mapped_file *Backing = nullptr;  // Mesh cache the arrays point into, they are not owned when set
+
+    model_lod Lods[MAX_MODEL_LODS];  // Coarser with every level, Lods[0] is the full mesh.
+    u32 lodCount;
 };
 
+// Models with up to this many vertices get 16 bit indices
+const u32 MAX_SHORT_INDEX_VERTICES = 0x10000;
+
+static inline size_t
+ModelIndexSize(u32 vertexCount)
+{
+    return vertexCount <= MAX_SHORT_INDEX_VERTICES ? sizeof(u16) : sizeof(u32);
+}
+
+// Copies indices into the narrowest index buffer that can address the model's vn vertices
+template <typename Index>
+static void
+SetModelIndices(Model3D *Model, const Index *indices, u32 count)
+{
+    Model->Indices16 = nullptr;
+    Model->Indices32 = nullptr;
+    if (ModelIndexSize(Model->vn) == sizeof(u16))
+    {
+        Model->Indices16 = new u16[count];
+        for (u32 i = 0; i < count; ++i) Model->Indices16[i] = static_cast<u16>(indices[i]);
+    }
+    else
+    {
+        Model->Indices32 = new u32[count];
+        for (u32 i = 0; i < count; ++i) Model->Indices32[i] = static_cast<u32>(indices[i]);
+    }
+    Model->in = count;
+}
+
+// Meshlets -------------------------------------------------------------------------
+const u32 MESHLET_MAX_TRIANGLES = 128;
+const u32 MESHLET_MAX_VERTICES = 64;
+
+template <typename Index>
+static model_meshlet
+MeshletBounds(const vertex3 *vertices, const Index *indices, u32 firstIndex, u32 triangleCount)
+{
+    model_meshlet meshlet = {};
+    meshlet.firstIndex = firstIndex;
+    meshlet.triangleCount = triangleCount;
+    const Index *first = indices + firstIndex;
+    const Index *last = first + triangleCount * 3;
+
+    // Sphere around the center of the corners' box
+    vec3f lo = vertices[*first].point;
+    vec3f hi = lo;
+    for (const Index *i = first; i < last; ++i)
+    {
+        const vec3f& p = vertices[*i].point;
+        lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+        hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+    }
+    meshlet.bounds.center = (lo + hi) * 0.5f;
+    for (const Index *i = first; i < last; ++i)
+    {
+        meshlet.bounds.radius = std::max(meshlet.bounds.radius, length(vertices[*i].point - meshlet.bounds.center));
+    }
+
+    // Cone around the facings of the triangles, the same cross product IsBackface tests
+    std::vector<vec3f> facings;
+    vec3f axis = {0, 0, 0};
+    for (const Index *i = first; i < last; i += 3)
+    {
+        vec3f n = cross(vertices[i[1]].point - vertices[i[0]].point, vertices[i[2]].point - vertices[i[0]].point);
+        f32 area = length(n);
+        if (area > 0)
+        {
+            facings.push_back(n / area);
+            axis += facings.back();
+        }
+    }
+    f32 axisLength = length(axis);
+    meshlet.coneAxis = axisLength > 0 ? axis / axisLength : vec3f{0, 0, 1};
+    f32 minDot = axisLength > 0 ? 1.0f : -1.0f;
+    for (const vec3f& n : facings)
+    {
+        minDot = std::min(minDot, dot(n, meshlet.coneAxis));
+    }
+
+    // Past about 84 degrees the test would practically never pass
+    meshlet.coneCutoff = minDot > 0.1f ? std::sqrt(1.0f - minDot * minDot) : 1.0f;
+    return meshlet;
+}
+
 /*
-328 bytes
+Cuts every level of detail into meshlets in index order, which the vertex cache ordering already
+keeps spatially coherent. A meshlet ends at MESHLET_MAX_TRIANGLES triangles or when the next
+triangle would bring it past MESHLET_MAX_VERTICES distinct vertices.
+*/
+template <typename Index>
+static void
+BuildModelMeshlets(Model3D *Model, const Index *indices)
+{
+    std::vector<model_meshlet> meshlets;
+    std::vector<u32> lastMeshlet(Model->vn, 0xFFFFFFFF);
+    for (u32 level = 0; level < Model->lodCount; ++level)
+    {
+        model_lod& lod = Model->Lods[level];
+        lod.firstMeshlet = static_cast<u32>(meshlets.size());
+
+        u32 first = lod.firstIndex;
+        u32 vertexCount = 0;
+        u32 current = static_cast<u32>(meshlets.size());
+        for (u32 index = lod.firstIndex; index < lod.firstIndex + lod.indexCount; index += 3)
+        {
+            u32 newVertices = 0;
+            for (u32 corner = 0; corner < 3; ++corner)
+            {
+                u32 v = indices[index + corner];
+                bool repeated = (corner > 0 && indices[index] == v) || (corner > 1 && indices[index + 1] == v);
+                newVertices += lastMeshlet[v] != current && !repeated ? 1 : 0;
+            }
+            if ((index - first) / 3 == MESHLET_MAX_TRIANGLES || vertexCount + newVertices > MESHLET_MAX_VERTICES)
+            {
+                meshlets.push_back(MeshletBounds(Model->Vertices, indices, first, (index - first) / 3));
+                first = index;
+                vertexCount = 0;
+                current = static_cast<u32>(meshlets.size());
+                newVertices = 3;
+            }
+            for (u32 corner = 0; corner < 3; ++corner)
+            {
+                lastMeshlet[indices[index + corner]] = current;
+            }
+            vertexCount += newVertices;
+        }
+        if (first < lod.firstIndex + lod.indexCount)
+        {
+            meshlets.push_back(MeshletBounds(Model->Vertices, indices, first, (lod.firstIndex + lod.indexCount - first) / 3));
+        }
+        lod.meshletCount = static_cast<u32>(meshlets.size()) - lod.firstMeshlet;
+    }
+
+    Model->Meshlets = new model_meshlet[meshlets.size()];
+    std::copy(meshlets.begin(), meshlets.end(), Model->Meshlets);
+    Model->meshletCount = static_cast<u32>(meshlets.size());
+}
+
+// Needs the full vertices, so before the model gets packed
+static void
+BuildModelMeshlets(Model3D *Model)
+{
+    if (Model->Indices16 != nullptr)
+        BuildModelMeshlets(Model, Model->Indices16);
+    else
+        BuildModelMeshlets(Model, Model->Indices32);
+}
+
+/*
+200 bytes
 */
 class Object3D
 {
 public:
     mat4x4 rotation;
-    Model3D *ObjectModel;
-    sphere BoundingSphere;
+    Model3D *ObjectModel;   // Shared between instances, never modified through an object.
     vec3f position;
     u32 ID;
     f32 scale;
 
+    // Filled in by camera::UpdateObjectMatrices, stale once the object or the camera moves
+    mat4x4 modelView;               // ObjectTransform() followed by the camera's view matrix.
+    mat3x3 normalMatrix;            // ObjectRotation() followed by the camera's rotation.
+    u32 matricesViewVersion = 0;    // camera::ViewVersion() the matrices were built against.
+    bool transformDirty = true;     // Set whenever position, rotation or scale change.
+
     // should we really return a copy? yes?
     const sphere ObjectBoundingSphere() const
     {
-        sphere bSphere = BoundingSphere;
+        sphere bSphere = ObjectModel->BoundingSphere;
         bSphere.center = bSphere.center * scale;
         bSphere.radius = bSphere.radius * scale;
         bSphere.center = bSphere.center * rotation;
@@ -94,25 +378,76 @@ public:
     {
         mat4x4 RotationX = get_x_rotation_mat(deg);
         rotation *= RotationX;
+        transformDirty = true;
     }
     void RotateObjectY(f32 deg)
     {
         mat4x4 RotationY = get_y_rotation_mat(deg);
         rotation *= RotationY;
+        transformDirty = true;
     }
 
     void RotateObjectZ(f32 deg)
     {
         mat4x4 RotationZ = get_z_rotation_mat(deg);
         rotation *= RotationZ;
+        transformDirty = true;
     }
 };
 
+// MODEL SHARING ---------------------------------------------------
+// Models loaded from OBJ files by name, so every object placed from the same file shares
+// one copy of the vertex and index data
+static std::unordered_map<std::string, Model3D *> LoadedModels;
+
+void DestroyModel(Model3D *Model);
+
+inline Model3D *
+AcquireModel(Model3D *Model)
+{
+    ++Model->refCount;
+    return Model;
+}
+
+// Frees the model once the last object using it lets go
+inline void
+ReleaseModel(Model3D *Model)
+{
+    assert(Model->refCount > 0);
+    if (--Model->refCount > 0)
+    {
+        return;
+    }
+
+    for (auto it = LoadedModels.begin(); it != LoadedModels.end(); ++it)
+    {
+        if (it->second == Model)
+        {
+            LoadedModels.erase(it);
+            break;
+        }
+    }
+    DestroyModel(Model);
+}
+
+// A new object that shares Model with every other instance of it
+static Object3D *
+CreateObjectInstance(Model3D *Model, const vec3f& position, f32 size)
+{
+    Object3D *Instance = new Object3D;
+    Instance->ObjectModel = AcquireModel(Model);
+    Instance->rotation = I_MATRIX_4X4;
+    Instance->position = position;
+    Instance->scale = size;
+    Instance->ID = 0;
+    return Instance;
+}
+
 static Object3D *
 CreateCube(const vec3f& position, f32 size = 1, u32 ID = 0xFFFFFFFF)
 {
     Model3D *Model = new Model3D;
-    vec3f *VertexPositions = new vec3f[24]
+    const vec3f positions[24] =
     {
         { 0.5,  0.5, -0.5}, { 0.5, -0.5, -0.5}, {-0.5, -0.5, -0.5}, {-0.5,  0.5, -0.5}, //FRONT
         { 0.5,  0.5,  0.5}, { 0.5, -0.5,  0.5}, { 0.5, -0.5, -0.5}, { 0.5,  0.5, -0.5}, // RIGHT
@@ -122,7 +457,7 @@ CreateCube(const vec3f& position, f32 size = 1, u32 ID = 0xFFFFFFFF)
         {-0.5, -0.5,  0.5}, {-0.5, -0.5, -0.5}, { 0.5, -0.5, -0.5}, { 0.5, -0.5,  0.5}  // BOTTOM
     };
 
-    color4 *VertexColors = new color4[24]
+    const color4 colors[24] =
     {
         RED,    RED,    RED,    RED,
         GREEN,  GREEN,  GREEN,  GREEN,
@@ -132,18 +467,7 @@ CreateCube(const vec3f& position, f32 size = 1, u32 ID = 0xFFFFFFFF)
         CYAN,   CYAN,   CYAN,   CYAN
     };
 
-    // Winding counter-clockwise
-    i32 *Indices = new i32[36]
-    { 
-        0, 1, 2,    0, 2, 3,    // FRONT
-        4, 5, 6,    4, 6, 7,    // RIGHT
-        8, 9, 10,   8, 10, 11,  // BACK
-        12, 13, 14, 12, 14, 15, // LEFT
-        16, 17, 18, 16, 18, 19, // TOP
-        20, 21, 22, 20, 22, 23  // BOTTOM
-    };
-    
-    vec3f *vertexNormals = new vec3f[24]
+    const vec3f normals[24] =
     {
         -VECTOR_K3, -VECTOR_K3, -VECTOR_K3, -VECTOR_K3, // FRONT
          VECTOR_I3,  VECTOR_I3,  VECTOR_I3,  VECTOR_I3, // RIGHT
@@ -153,7 +477,8 @@ CreateCube(const vec3f& position, f32 size = 1, u32 ID = 0xFFFFFFFF)
         -VECTOR_J3, -VECTOR_J3, -VECTOR_J3, -VECTOR_J3  // BOTTOM
     };
 
-    i32 *normalIndices = new i32[36]
+    // Winding counter-clockwise
+    const u16 indices[36] =
     { 
         0, 1, 2,    0, 2, 3,    // FRONT
         4, 5, 6,    4, 6, 7,    // RIGHT
@@ -163,318 +488,635 @@ CreateCube(const vec3f& position, f32 size = 1, u32 ID = 0xFFFFFFFF)
         20, 21, 22, 20, 22, 23  // BOTTOM
     };
 
-    Model->VertexPositions = VertexPositions;
-    Model->vertexNormals = vertexNormals;
-    Model->VertexColors = VertexColors;
-    Model->vertexIndices = Indices;
-    Model->normalIndices = normalIndices;
-    Model->vn = 8;
-    Model->in = 36;
-
-    Object3D *Cube = new Object3D;
-    
-    Cube->ObjectModel = Model;
-    Cube->scale = size;
-    Cube->position = position;
-    Cube->rotation = I_MATRIX_4X4;
+    vertex3 *Vertices = new vertex3[24];
+    for (int i = 0; i < 24; ++i)
+    {
+        Vertices[i] = {positions[i], normals[i], colors[i]};
+    }
+
+    Model->Vertices = Vertices;
+    Model->PackedVertices = nullptr;
+    Model->PackedColors = nullptr;
+    Model->vn = 24;
+    SetModelIndices(Model, indices, 36);
+    Model->Lods[0] = {0, 36, 0, 0, 0.0f};
+    Model->lodCount = 1;
+    BuildModelMeshlets(Model);
 
     vec3f average_center = {0, 0, 0};
     f32 radius = 0.0f;
-    for (int i = 0; i < Cube->ObjectModel->vn; ++i)
+    for (int i = 0; i < Model->vn; ++i)
     {
-        average_center += Cube->ObjectModel->VertexPositions[i];
+        average_center += Model->Vertices[i].point;
     }
-    average_center /= Cube->ObjectModel->vn;
+    average_center /= Model->vn;
 
-    for (int i = 0; i < Cube->ObjectModel->vn; ++i)
+    for (int i = 0; i < Model->vn; ++i)
     {
-        f32 square_length = length_squared(Cube->ObjectModel->VertexPositions[i] - average_center);
+        f32 square_length = length_squared(Model->Vertices[i].point - average_center);
         radius = square_length > radius ? square_length : radius;
     }
 
-    radius = static_cast<f32>(std::sqrt(radius)) * size;
+    radius = static_cast<f32>(std::sqrt(radius));
 
-    Cube->BoundingSphere = {average_center, radius};
+    Model->BoundingSphere = {average_center, radius};
+    Model->refCount = 0;
 
+    Object3D *Cube = CreateObjectInstance(Model, position, size);
     Cube->ID = ID;
     return Cube;
 }
 
-// Obj Parser ------------------------------------------------------------------------
+// Mesh Cache ------------------------------------------------------------------------
+/*
+A model loaded from an OBJ file is written next to it as <file>.rtmesh: this header followed by
+its vertices, indices (padded to 4 bytes) and meshlets exactly as Model3D holds them.
+Later loads map the cache and point the model's arrays into the mapping, so nothing is parsed,
+normalized, simplified or copied. A cache whose version or source size and hash don't match, or
+whose indices or meshlets point out of range, is rebuilt.
 
-Object3D *
-LoadObjectFromOBJ(std::string name, const vec3f& position, f32 size)
+216 bytes
+*/
+struct mesh_cache_header
 {
-    std::string filePath = "./data/" + name;
-    std::ifstream objFile(filePath);
+    char magic[4];          // "RTMC"
+    u32 version;            // MESH_CACHE_VERSION, bumped whenever Model3D's arrays or their order change.
+    u64 sourceSize;         // Size of the OBJ file the model was built from.
+    u64 sourceHash;         // MeshCacheHash of the OBJ file.
+    sphere boundingSphere;
+    u32 vn;
+    u32 in;
+    u32 meshletCount;
+    u32 lodCount;
+    model_lod lods[MAX_MODEL_LODS];
+};
+
+const u32 MESH_CACHE_VERSION = 6;
 
-    if (!objFile.is_open())
+// Not cryptographic, only has to notice that the OBJ file changed. Reads 8 bytes at a time.
+static u64
+MeshCacheHash(const char *data, size_t size)
+{
+    u64 hash = 0xCBF29CE484222325ull ^ size;
+    size_t words = size / sizeof(u64);
+    for (size_t i = 0; i < words; ++i)
+    {
+        u64 word;
+        std::memcpy(&word, data + i * sizeof(u64), sizeof(u64));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    for (size_t i = words * sizeof(u64); i < size; ++i)
     {
-        objFile = std::ifstream("." + filePath);
+        hash = (hash ^ static_cast<u8>(data[i])) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static size_t
+MeshCacheMeshletOffset(u32 vn, u32 in)
+{
+    size_t indexBytes = in * ModelIndexSize(vn);
+    return sizeof(mesh_cache_header) + vn * sizeof(vertex3) + ((indexBytes + 3) & ~static_cast<size_t>(3));
+}
 
-        if (!objFile.is_open())
+static size_t
+MeshCacheSize(u32 vn, u32 in, u32 meshletCount)
+{
+    return MeshCacheMeshletOffset(vn, in) + meshletCount * sizeof(model_meshlet);
+}
+
+// A damaged cache can still have the right size, but drawing it must never read past the vertices
+template <typename Index>
+static bool
+MeshCacheIndicesValid(const Index *indices, u32 in, u32 vn)
+{
+    for (u32 i = 0; i < in; ++i)
+    {
+        if (indices[i] >= vn)
         {
-            std::cerr << "Error: Could not open file: " << filePath << "!" << std::endl;
-            return nullptr;
+            return false;
+        }
+    }
+    return true;
+}
+
+// nullptr when there is no usable cache at path
+static Model3D *
+LoadModelFromCache(const std::string& path, u64 sourceSize, u64 sourceHash)
+{
+    mapped_file *cache = new mapped_file;
+    mesh_cache_header header;
+    bool valid = cache->Open(path) && cache->Size() >= sizeof(header);
+    if (valid)
+    {
+        std::memcpy(&header, cache->Data(), sizeof(header));
+        valid = std::memcmp(header.magic, "RTMC", 4) == 0 &&
+                header.version == MESH_CACHE_VERSION &&
+                header.sourceSize == sourceSize &&
+                header.sourceHash == sourceHash &&
+                cache->Size() == MeshCacheSize(header.vn, header.in, header.meshletCount) &&
+                header.lodCount >= 1 && header.lodCount <= MAX_MODEL_LODS;
+        for (u32 level = 0; valid && level < header.lodCount; ++level)
+        {
+            const model_lod& lod = header.lods[level];
+            valid = lod.firstIndex <= header.in && lod.indexCount <= header.in - lod.firstIndex &&
+                    lod.firstMeshlet <= header.meshletCount && lod.meshletCount <= header.meshletCount - lod.firstMeshlet;
         }
     }
+    if (valid)
+    {
+        const char *indices = cache->Data() + sizeof(header) + header.vn * sizeof(vertex3);
+        valid = ModelIndexSize(header.vn) == sizeof(u16) ?
+                MeshCacheIndicesValid(reinterpret_cast<const u16 *>(indices), header.in, header.vn) :
+                MeshCacheIndicesValid(reinterpret_cast<const u32 *>(indices), header.in, header.vn);
+        const model_meshlet *meshlets = reinterpret_cast<const model_meshlet *>(cache->Data() + MeshCacheMeshletOffset(header.vn, header.in));
+        for (u32 i = 0; valid && i < header.meshletCount; ++i)
+        {
+            valid = meshlets[i].firstIndex <= header.in && static_cast<u64>(meshlets[i].triangleCount) * 3 <= header.in - meshlets[i].firstIndex;
+        }
+    }
+    if (!valid)
+    {
+        delete cache;
+        return nullptr;
+    }
+
+    // The mapping is read-only, which is fine since models are never modified after loading
+    char *at = const_cast<char *>(cache->Data()) + sizeof(header);
+    Model3D *Model = new Model3D;
+    Model->Vertices = reinterpret_cast<vertex3 *>(at);
+    at += header.vn * sizeof(vertex3);
+    Model->Indices16 = ModelIndexSize(header.vn) == sizeof(u16) ? reinterpret_cast<u16 *>(at) : nullptr;
+    Model->Indices32 = ModelIndexSize(header.vn) == sizeof(u32) ? reinterpret_cast<u32 *>(at) : nullptr;
+    Model->Meshlets = reinterpret_cast<model_meshlet *>(const_cast<char *>(cache->Data()) + MeshCacheMeshletOffset(header.vn, header.in));
+    Model->PackedVertices = nullptr;
+    Model->PackedColors = nullptr;
+
+    Model->BoundingSphere = header.boundingSphere;
+    Model->vn = header.vn;
+    Model->in = header.in;
+    Model->meshletCount = header.meshletCount;
+    Model->refCount = 0;
+    Model->Backing = cache;
+    std::memcpy(Model->Lods, header.lods, sizeof(header.lods));
+    Model->lodCount = header.lodCount;
+    return Model;
+}
+
+// Written to a temporary file first, so an interrupted write never leaves a broken cache behind
+static bool
+WriteModelCache(const std::string& path, const Model3D *Model, u64 sourceSize, u64 sourceHash)
+{
+    mesh_cache_header header = {};
+    std::memcpy(header.magic, "RTMC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceHash = sourceHash;
+    header.boundingSphere = Model->BoundingSphere;
+    header.vn = Model->vn;
+    header.in = Model->in;
+    header.meshletCount = Model->meshletCount;
+    header.lodCount = Model->lodCount;
+    std::memcpy(header.lods, Model->Lods, sizeof(header.lods));
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(Model->Vertices), Model->vn * sizeof(vertex3));
+        const void *indices = Model->Indices16 != nullptr ? static_cast<const void *>(Model->Indices16) : Model->Indices32;
+        file.write(static_cast<const char *>(indices), Model->in * ModelIndexSize(Model->vn));
+        const char padding[3] = {};
+        file.write(padding, MeshCacheMeshletOffset(Model->vn, Model->in) - (sizeof(header) + Model->vn * sizeof(vertex3) + Model->in * ModelIndexSize(Model->vn)));
+        file.write(reinterpret_cast<const char *>(Model->Meshlets), Model->meshletCount * sizeof(model_meshlet));
+        if (!file.good())
+        {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    std::remove(path.c_str());
+    return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+// Model Packing ---------------------------------------------------------------------
+/*
+Packed models keep 16 bit positions quantized inside their bounding sphere and octahedral
+normals, 10 bytes per vertex instead of 28, and drop the colors when they are all the same.
+The vertex stage decodes them, so the rest of the pipeline can't tell the difference.
+*/
+static void
+PackModel(Model3D *Model)
+{
+    if (Model->Vertices == nullptr)
+    {
+        return;
+    }
 
-    std::string line;
-    std::vector<vec3f> vertices;
-    std::vector<vec3f> normals;
-    std::vector<i32> vertexIndices;
-    std::vector<i32> normalIndices;
-    while (std::getline(objFile, line))
+    packed_vertex *packed = new packed_vertex[Model->vn];
+    bool uniformColor = true;
+    for (u32 i = 0; i < Model->vn; ++i)
     {
-        std::istringstream stream(line);
-        std::string word;
-        stream >> word;
+        const vertex3& vertex = Model->Vertices[i];
+        PackPosition(vertex.point, Model->BoundingSphere, packed[i].position);
+        PackNormal(vertex.normal, packed[i].normal);
 
-        if (word == "v")
+        const color4& first = Model->Vertices[0].color;
+        uniformColor = uniformColor && vertex.color.r == first.r && vertex.color.g == first.g &&
+                                       vertex.color.b == first.b && vertex.color.a == first.a;
+    }
+
+    Model->PackedColors = nullptr;
+    Model->UniformColor = Model->vn > 0 ? Model->Vertices[0].color : DEFAULT;
+    if (!uniformColor)
+    {
+        Model->PackedColors = new color4[Model->vn];
+        for (u32 i = 0; i < Model->vn; ++i)
         {
-            try
-            {
-                float values[3];
-                for (int i = 0; i < 3; ++i)
-                {
-                    stream >> word;
-                    values[i] = std::stof(word);
-                }
-                vec3f vec = {values[0], values[1], values[2]};
-                vertices.push_back(vec);
-            }
-            catch(const std::invalid_argument& e)
-            {
-                std::cerr << "Invalid argument: " << e.what() << std::endl;
-            }
-            catch(const std::out_of_range& e)
-            {
-                std::cerr << "Out of range: " << e.what() << std::endl;
-            }
+            Model->PackedColors[i] = Model->Vertices[i].color;
+        }
+    }
+
+    if (Model->Backing == nullptr)
+    {
+        delete[] Model->Vertices;
+    }
+    Model->Vertices = nullptr;
+    Model->PackedVertices = packed;
+}
+
+// Back to full vertices. Cached models get their exact vertices back, others the decoded ones.
+static void
+UnpackModel(Model3D *Model)
+{
+    if (Model->PackedVertices == nullptr)
+    {
+        return;
+    }
+
+    if (Model->Backing != nullptr)
+    {
+        Model->Vertices = reinterpret_cast<vertex3 *>(const_cast<char *>(Model->Backing->Data()) + sizeof(mesh_cache_header));
+    }
+    else
+    {
+        mat4x4 unpackPosition = UnpackPositionMatrix(Model->BoundingSphere);
+        Model->Vertices = new vertex3[Model->vn];
+        for (u32 i = 0; i < Model->vn; ++i)
+        {
+            const packed_vertex& packed = Model->PackedVertices[i];
+            vec3f position = PackedPositionVector(packed) * unpackPosition;
+            color4 color = Model->PackedColors != nullptr ? Model->PackedColors[i] : Model->UniformColor;
+            Model->Vertices[i] = {position, UnpackNormal(packed.normal), color};
+        }
+    }
+
+    delete[] Model->PackedVertices;
+    delete[] Model->PackedColors;
+    Model->PackedVertices = nullptr;
+    Model->PackedColors = nullptr;
+}
+
+static inline color4
+ModelVertexColor(const Model3D *Model, i32 index)
+{
+    if (Model->Vertices != nullptr) return Model->Vertices[index].color;
+    return Model->PackedColors != nullptr ? Model->PackedColors[index] : Model->UniformColor;
+}
+
+// Obj Parser ------------------------------------------------------------------------
+/*
+Turns the separate position and normal indices of an OBJ file into one vertex per distinct
+(position, normal) pair, in order of first use, and a single index buffer addressing them.
+Input indices are 1-based like in the file, triangles with an index out of range are dropped
+and counted in the return value.
+*/
+static u32
+WeldVertices(const std::vector<vec3f>& positions, const std::vector<vec3f>& normals,
+             const std::vector<i32>& positionIndices, const std::vector<i32>& normalIndices,
+             std::vector<vertex3>& vertices, std::vector<u32>& indices)
+{
+    assert(positionIndices.size() == normalIndices.size());
+
+    // Most positions only ever pair with one normal, the rest go through the map
+    std::vector<i32> firstVertex(positions.size(), -1);
+    std::unordered_map<u64, i32> otherVertices;
+
+    vertices.clear();
+    vertices.reserve(positions.size());
+    indices.clear();
+    indices.reserve(positionIndices.size());
+
+    u32 dropped = 0;
+    for (size_t triangle = 0; triangle < positionIndices.size() / 3; ++triangle)
+    {
+        bool valid = true;
+        for (size_t corner = triangle * 3; corner < triangle * 3 + 3; ++corner)
+        {
+            valid = valid && static_cast<u32>(positionIndices[corner] - 1) < positions.size()
+                          && static_cast<u32>(normalIndices[corner] - 1) < normals.size();
         }
-        else if (word == "vn")
+        if (!valid)
         {
-            try
-            {
-                float values[3];
-                for (int i = 0; i < 3; ++i)
-                {
-                    stream >> word;
-                    values[i] = std::stof(word);
-                }
-                vec3f vec = {values[0], values[1], values[2]};
-                normals.push_back(vec);
-            }
-            catch(const std::invalid_argument& e)
-            {
-                std::cerr << "Invalid argument: " << e.what() << std::endl;
-            }
-            catch(const std::out_of_range& e)
-            {
-                std::cerr << "Out of range: " << e.what() << std::endl;
-            }
+            ++dropped;
+            continue;
         }
-        else if (word == "f")
+
+        for (size_t corner = triangle * 3; corner < triangle * 3 + 3; ++corner)
         {
-            std::vector<i32> faceVertexIndices;
-            std::vector<i32> faceNormalIndices;
-            try
+            u32 position = positionIndices[corner] - 1;
+            u32 normal = normalIndices[corner] - 1;
+
+            i32& first = firstVertex[position];
+            if (first < 0)
             {
-                while(stream >> word)
-                {
-                    std::vector<std::string> indicesTemp;
-                    std::stringstream ss(word);
-                    std::string index;
-                    while(std::getline(ss, index, '/'))
-                    {
-                        indicesTemp.push_back(index);
-                    }
-
-                    // parse the vertex index
-                    if (!indicesTemp[0].empty())
-                    {
-                        faceVertexIndices.push_back(std::stoi(indicesTemp[0]));
-                    }
-
-                    // parse normals
-                    if (indicesTemp.size() > 2 && !indicesTemp[2].empty())
-                    {
-                        faceNormalIndices.push_back(std::stoi(indicesTemp[2]));
-                    }
-                }
+                first = static_cast<i32>(vertices.size());
+                vertices.push_back({positions[position], normals[normal], DEFAULT});
+            }
 
-                // plit quads into two triangels 1, 2, 3 and 1, 3, 4.
-                if (faceVertexIndices.size() == 3)
-                {
-                    vertexIndices.insert(vertexIndices.end(), faceVertexIndices.begin(), faceVertexIndices.end());
-                    normalIndices.insert(normalIndices.end(), faceNormalIndices.begin(),faceNormalIndices.end());
-                }
-                else if (faceVertexIndices.size() == 4)
-                {
-                    vertexIndices.push_back(faceVertexIndices[0]);
-                    vertexIndices.push_back(faceVertexIndices[1]);
-                    vertexIndices.push_back(faceVertexIndices[2]);
-                    vertexIndices.push_back(faceVertexIndices[0]);
-                    vertexIndices.push_back(faceVertexIndices[2]);
-                    vertexIndices.push_back(faceVertexIndices[3]);
-
-                    if (faceNormalIndices.size() == 4)
-                    {
-                        normalIndices.push_back(faceNormalIndices[0]);
-                        normalIndices.push_back(faceNormalIndices[1]);
-                        normalIndices.push_back(faceNormalIndices[2]);
-                        normalIndices.push_back(faceNormalIndices[0]);
-                        normalIndices.push_back(faceNormalIndices[2]);
-                        normalIndices.push_back(faceNormalIndices[3]);
-                    }
-                }
-                else if (faceVertexIndices.size() > 4)
+            i32 vertex = first;
+            if (!(vertices[first].normal == normals[normal]))
+            {
+                u64 key = (static_cast<u64>(position) << 32) | normal;
+                auto found = otherVertices.emplace(key, static_cast<i32>(vertices.size()));
+                if (found.second)
                 {
-                    i32 pivotVertex = faceVertexIndices[0];
-                    for (size_t i = 1; i < faceVertexIndices.size() - 1; ++i)
-                    {
-                        vertexIndices.push_back(pivotVertex);
-                        vertexIndices.push_back(faceVertexIndices[i]);
-                        vertexIndices.push_back(faceVertexIndices[i + 1]);
-                    }
-                    
-                    if (faceNormalIndices.size() > 4)
-                    {
-                        i32 pivotNormal = faceNormalIndices[0];
-                        for (size_t i = 1; i < faceNormalIndices.size() - 1; ++i)
-                        {
-                            normalIndices.push_back(pivotNormal);
-                            normalIndices.push_back(faceNormalIndices[i]);
-                            normalIndices.push_back(faceNormalIndices[i+1]);
-                        }
-                    }
-
-                    std::cerr << "WARNING: render toy only supports faces of 4 or less vertices. Non-convex polygons will have undefined behaviour!\n";
+                    vertices.push_back({positions[position], normals[normal], DEFAULT});
                 }
+                vertex = found.first->second;
             }
-            catch(const std::invalid_argument& e)
+            indices.push_back(static_cast<u32>(vertex));
+        }
+    }
+    return dropped;
+}
+
+const u32 MIN_LOD_TRIANGLES = 64;
+
+/*
+Simplifies the mesh into a chain of levels with half the triangles of the one before, until it
+gets below MIN_LOD_TRIANGLES or stops shrinking. Every level gets the vertex cache and overdraw
+ordering, then the vertices are renumbered coarsest level first so the coarse levels touch a
+compact prefix of them. Leaves every level in indices, finest first, and returns the level count.
+*/
+static u32
+BuildModelLods(std::vector<vertex3>& vertices, std::vector<u32>& indices, model_lod lods[MAX_MODEL_LODS])
+{
+    std::vector<std::vector<u32>> levels(1, indices);
+    std::vector<f32> errors(1, 0.0f);
+    if (indices.size() / 3 >= 2 * MIN_LOD_TRIANGLES)
+    {
+        mesh_simplifier<vertex3> simplifier(vertices, indices);
+        while (levels.size() < MAX_MODEL_LODS)
+        {
+            u32 triangles = static_cast<u32>(levels.back().size() / 3);
+            if (triangles / 2 < MIN_LOD_TRIANGLES)
             {
-                std::cerr << "Invalid argument: " << e.what() << std::endl;
+                break;
             }
-            catch(const std::out_of_range& e)
+            simplifier.Simplify(triangles / 2);
+            if (simplifier.Indices().size() / 3 > triangles * 3 / 4)
             {
-                std::cerr << "Out of range: " << e.what() << std::endl;
+                break;
             }
+            levels.push_back(simplifier.Indices());
+            errors.push_back(simplifier.Error());
         }
-        else
+    }
+
+    for (std::vector<u32>& level : levels)
+    {
+        OptimizeVertexCache(level, static_cast<u32>(vertices.size()));
+        OptimizeOverdraw(level, vertices);
+    }
+
+    std::vector<u32> coarsestFirst;
+    for (size_t level = levels.size(); level-- > 0;)
+    {
+        coarsestFirst.insert(coarsestFirst.end(), levels[level].begin(), levels[level].end());
+    }
+    OptimizeVertexFetch(coarsestFirst, vertices);
+
+    indices.clear();
+    size_t end = coarsestFirst.size();
+    for (size_t level = 0; level < levels.size(); ++level)
+    {
+        size_t begin = end - levels[level].size();
+        lods[level].firstIndex = static_cast<u32>(indices.size());
+        lods[level].indexCount = static_cast<u32>(levels[level].size());
+        lods[level].error = errors[level];
+        indices.insert(indices.end(), coarsestFirst.begin() + begin, coarsestFirst.begin() + end);
+        end = begin;
+    }
+    return static_cast<u32>(levels.size());
+}
+
+
+// With workers, large files are parsed on all of the pool's threads. With useCache the result is
+// cached, see mesh_cache_header. parseMs gets the time spent in ParseOBJ, 0 when it wasn't called.
+Model3D *
+LoadModelFromOBJ(std::string name, worker_pool *workers = nullptr, bool useCache = true, f64 *parseMs = nullptr)
+{
+    if (parseMs != nullptr)
+    {
+        *parseMs = 0.0;
+    }
+    std::string filePath = "./data/" + name;
+    mapped_file objFile;
+
+    if (!objFile.Open(filePath))
+    {
+        if (!objFile.Open("." + filePath))
         {
-            continue;
+            std::cerr << "Error: Could not open file: " << filePath << "!" << std::endl;
+            return nullptr;
         }
+        filePath = "." + filePath;
+    }
+
+    auto loadStart = std::chrono::steady_clock::now();
+    std::string cachePath = filePath + ".rtmesh";
+    u64 sourceHash = MeshCacheHash(objFile.Data(), objFile.Size());
+    Model3D *cached = useCache ? LoadModelFromCache(cachePath, objFile.Size(), sourceHash) : nullptr;
+    if (cached != nullptr)
+    {
+        std::cout << name << " has been loaded from " << cachePath << " in " << PerfMsSince(loadStart) << " ms\n";
+        std::cout << "Vertices: " << cached->vn << "\n";
+        std::cout << "Faces :" << cached->Lods[0].indexCount / 3 << " in " << cached->lodCount << " levels of detail" << std::endl;
+        return cached;
+    }
+
+    auto parseStart = std::chrono::steady_clock::now();
+    obj_data parsed;
+    ParseOBJ(objFile.Data(), objFile.Data() + objFile.Size(), parsed, workers);
+    f64 parseTime = PerfMsSince(parseStart);
+    if (parseMs != nullptr)
+    {
+        *parseMs = parseTime;
+    }
+
+    if (parsed.errors > 0)
+    {
+        std::cerr << "WARNING: " << parsed.errors << " lines of " << name << " could not be parsed and were skipped\n";
     }
+    if (parsed.largePolygons > 0)
+    {
+        std::cerr << "WARNING: render toy only supports faces of 4 or less vertices. Non-convex polygons will have undefined behaviour!\n";
+    }
+
+    std::vector<vec3f>& positions = parsed.vertices;
+    std::vector<vec3f>& normals = parsed.normals;
+    std::vector<i32>& positionIndices = parsed.vertexIndices;
+    std::vector<i32>& normalIndices = parsed.normalIndices;
 
-    if (normalIndices.empty())
+    // Unless every face has normal indices, normals go with positions
+    bool normalsPerPosition = normalIndices.size() != positionIndices.size();
+    if (normalsPerPosition)
     {
-        normalIndices = vertexIndices;
+        normalIndices = positionIndices;
     }
 
-    if (normals.empty() || vertices.size() != normals.size())
+    if (normals.empty() || (normalsPerPosition && normals.size() != positions.size()))
     {
         std::cerr << "WARNING: Normals not provided. rastertoy will attempt generating normals\n";
-        normals.resize(vertices.size());
-        for (size_t i = 0; i < normalIndices.size() / 3; ++i)
+        normals.assign(positions.size(), vec3f{0.f, 0.f, 0.f});
+        normalIndices = positionIndices;
+        for (size_t i = 0; i < positionIndices.size() / 3; ++i)
         {
-            int in0 = normalIndices[i * 3] - 1;
-            int in1 = normalIndices[i * 3 + 1] - 1;
-            int in2 = normalIndices[i * 3 + 2] - 1;
+            u32 i0 = positionIndices[i * 3] - 1;
+            u32 i1 = positionIndices[i * 3 + 1] - 1;
+            u32 i2 = positionIndices[i * 3 + 2] - 1;
+            if (i0 >= positions.size() || i1 >= positions.size() || i2 >= positions.size())
+            {
+                continue;
+            }
 
-            vec3f v0 = vertices[in0];
-            vec3f v1 = vertices[in1];
-            vec3f v2 = vertices[in2];
+            vec3f v0 = positions[i0];
+            vec3f v1 = positions[i1];
+            vec3f v2 = positions[i2];
 
             vec3f n = (cross(v1 - v0, v2 - v0));
-            normals[in0] += n; // n0
-            normals[in1] += n; // n1
-            normals[in2] += n; // n2
+            normals[i0] += n; // n0
+            normals[i1] += n; // n1
+            normals[i2] += n; // n2
         }
     }
 
-    assert(vertexIndices.size() == normalIndices.size());
-    assert(vertices.size() == normals.size());
-
-    Model3D *objectModel = new Model3D;
-
-    vec3f *vertexPositions = new vec3f[vertices.size()];
-    vec3f *vertexNormals = new vec3f[normals.size()];
-    color4 *vertexColors = new color4[vertices.size()];
-    i32 *vertexIndicesTemp = new int[vertexIndices.size()];
-    i32 *normalIndicesTemp = new int[normalIndices.size()];
-
-    Object3D *newObject = new Object3D;
-    newObject->rotation = I_MATRIX_4X4;
-    newObject->ObjectModel = objectModel;
     vec3f origin = {0.f,0.f,0.f};
-    for (const auto& v : vertices)
+    for (const auto& v : positions)
     {
         origin += v;
     }
-    if (!vertices.empty())
+    if (!positions.empty())
     {
-        origin /= vertices.size();
+        origin /= positions.size();
     }
 
     f32 radius = 0.f;
-    for (const auto& v : vertices)
+    for (const auto& v : positions)
     {
         f32 square_length = length_squared(v - origin);
         radius = square_length > radius ? square_length : radius;
     }
     radius = std::sqrt(radius);
 
-    newObject->BoundingSphere = sphere{origin, radius};
-    newObject->position = position;
-    newObject->ID = 0;
-    newObject->scale = size;
-
-    for (size_t i = 0; i < vertices.size(); ++i)
+    std::vector<vertex3> vertices;
+    std::vector<u32> indices;
+    u32 droppedTriangles = WeldVertices(positions, normals, positionIndices, normalIndices, vertices, indices);
+    if (droppedTriangles > 0)
     {
-        vertexPositions[i] = vertices[i] / radius;
+        std::cerr << "WARNING: " << droppedTriangles << " triangles of " << name << " index past the end of the file and were dropped\n";
     }
-    objectModel->VertexPositions = vertexPositions;
 
-    for (size_t i = 0; i < normals.size(); ++i)
+    // Positions get divided by the radius, so the sphere ends up with a radius of 1 and the
+    // LOD errors come out in model units
+    for (vertex3& vertex : vertices)
     {
-        vertexNormals[i] = normalize(normals[i]);
+        vertex = {vertex.point / radius, normalize(vertex.normal), DEFAULT};
     }
-    objectModel->vertexNormals = vertexNormals;
 
-    std::fill(vertexColors, vertexColors + vertices.size(), DEFAULT);
-    objectModel->VertexColors = vertexColors;
+    // Simplified and reordered before caching, so loading from the cache gets both for free
+    Model3D *objectModel = new Model3D;
+    objectModel->BoundingSphere = sphere{origin / radius, 1.0f};
+    f32 acmrBefore = MeshACMR(indices, static_cast<u32>(vertices.size()));
+    objectModel->lodCount = BuildModelLods(vertices, indices, objectModel->Lods);
+    const model_lod& fullMesh = objectModel->Lods[0];
+    f32 acmrAfter = MeshACMR(std::vector<u32>(indices.begin(), indices.begin() + fullMesh.indexCount), static_cast<u32>(vertices.size()));
+
+    vertex3 *modelVertices = new vertex3[vertices.size()];
+    std::copy(vertices.begin(), vertices.end(), modelVertices);
+    objectModel->Vertices = modelVertices;
 
-    for (size_t i = 0; i < vertexIndices.size(); ++i)
+    objectModel->vn = vertices.size();
+    SetModelIndices(objectModel, indices.data(), static_cast<u32>(indices.size()));
+    BuildModelMeshlets(objectModel);
+    objectModel->PackedVertices = nullptr;
+    objectModel->PackedColors = nullptr;
+    objectModel->refCount = 0;
+
+    std::cout << name << " has been loaded\n";
+    std::cout << "Vertices: " << vertices.size() << " (welded from " << positions.size() << " positions and " << normals.size() << " normals)\n";
+    std::cout << "Faces :" << fullMesh.indexCount / 3 << "\n";
+    std::cout << "LODs:";
+    for (u32 level = 0; level < objectModel->lodCount; ++level)
     {
-        vertexIndicesTemp[i] = vertexIndices[i] - 1;
+        std::cout << " " << objectModel->Lods[level].indexCount / 3 << " (" << objectModel->Lods[level].error << ")";
     }
-    objectModel->vertexIndices = vertexIndicesTemp;
+    std::cout << "\n";
+    std::cout << "Meshlets: " << objectModel->meshletCount << "\n";
+    std::cout << "Parsed " << objFile.Size() / (1024.0 * 1024.0) << " MB in " << parseTime << " ms ("
+              << (parseTime > 0 ? objFile.Size() / (1024.0 * 1024.0) / (parseTime / 1000.0) : 0.0) << " MB/s)\n";
+    std::cout << "ACMR (" << MESH_OPTIMIZE_CACHE_SIZE << " entry FIFO): " << acmrBefore << " -> " << acmrAfter << std::endl;
 
-    for (size_t i = 0; i < normalIndices.size(); ++i)
+    if (useCache && !WriteModelCache(cachePath, objectModel, objFile.Size(), sourceHash))
     {
-        normalIndicesTemp[i] = normalIndices[i] - 1;
+        std::cerr << "WARNING: Could not write the mesh cache " << cachePath << "\n";
     }
-    objectModel->normalIndices = normalIndicesTemp;
+    return objectModel;
+}
 
-    objectModel->vn = vertices.size();
-    objectModel->in = vertexIndices.size();
+// Places an instance of the model in name, the file is only loaded and parsed the first time
+Object3D *
+LoadObjectFromOBJ(std::string name, const vec3f& position, f32 size, worker_pool *workers = nullptr)
+{
+    auto loaded = LoadedModels.find(name);
+    Model3D *Model = loaded != LoadedModels.end() ? loaded->second : nullptr;
+    if (Model == nullptr)
+    {
+        Model = LoadModelFromOBJ(name, workers);
+        if (Model == nullptr)
+        {
+            return nullptr;
+        }
+        LoadedModels[name] = Model;
+    }
 
-    std::cout << name << " has been loaded\n";
-    std::cout << "Vertices: " << vertices.size() << "\n";
-    std::cout << "Normals: " << normals.size() << "\n";
-    std::cout << "Faces :" << vertexIndices.size() / 3 << std::endl;
-    objFile.close();
-    return newObject;
+    return CreateObjectInstance(Model, position, size);
 }
 
 void
 DestroyModel(Model3D *Model)
 {
-    delete[] Model->VertexPositions;
-    delete[] Model->vertexNormals;
-    delete[] Model->VertexColors;
-    delete[] Model->vertexIndices;
+    if (Model->Backing != nullptr)
+    {
+        delete Model->Backing;
+    }
+    else
+    {
+        delete[] Model->Vertices;
+        delete[] Model->Indices16;
+        delete[] Model->Indices32;
+        delete[] Model->Meshlets;
+    }
+    delete[] Model->PackedVertices;
+    delete[] Model->PackedColors;
     delete   Model;
 
     Model = nullptr;
@@ -483,7 +1125,7 @@ DestroyModel(Model3D *Model)
 void
 DestroyObject3D(Object3D *WorldObject)
 {
-    DestroyModel(WorldObject->ObjectModel);
+    ReleaseModel(WorldObject->ObjectModel);
     delete WorldObject;
 
     WorldObject = nullptr;
@@ -0,0 +1,126 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <chrono>
+#include <vector>
+
+/*
+Frame instrumentation. With PERF_ON defined (see platform.h) the renderer counts what every
+pipeline stage did, times the stages and every object it draws, and rastertoy::LastFramePerf
+returns the numbers of the last frame. Without PERF_ON the macros below compile to nothing and
+LastFramePerf returns zeros.
+*/
+
+enum PerfCounter
+{
+    PERF_OBJECTS_IN,            // Objects considered for drawing.
+    PERF_OBJECTS_CULLED,        // Of those, rejected by their bounding sphere.
+    PERF_MESHLETS_IN,           // Meshlets of the drawn objects' levels of detail.
+    PERF_MESHLETS_OUTSIDE,      // Of those, rejected by their bounding sphere.
+    PERF_MESHLETS_BACKFACE,     // Rejected by their normal cone.
+    PERF_VERTICES,              // Vertices transformed.
+    PERF_TRIANGLES_IN,          // Triangles received by ProcessTriangle.
+    PERF_TRIANGLES_BACKFACE,    // Culled by IsBackface.
+    PERF_TRIANGLES_OUTSIDE,     // Completely outside the frustum.
+    PERF_TRIANGLES_CLIPPED,     // Cut by a frustum plane, split or not.
+    PERF_TRIANGLES_SPLIT,       // Of the clipped ones, the ones that became more than one triangle.
+    PERF_TRIANGLES_GUARD_BAND,  // Past a screen edge but inside the guard band, left to the rasterizer's scissor.
+    PERF_TRIANGLES_BINNED,      // Filled triangles handed to the tile rasterizer.
+    PERF_PIXELS_TESTED,         // Filled triangle pixels that went through the depth test.
+    PERF_PIXELS_WRITTEN,        // Of those, the ones that passed it.
+    PERF_HIZ_TRIANGLES_HIDDEN,  // Binned triangles the depth hierarchy dropped before setup, once per tile.
+    PERF_HIZ_BLOCKS_HIDDEN,     // Depth hierarchy blocks skipped inside the triangles that were set up.
+    PERF_PIXELS_LIT,            // G-buffer pixels the deferred lighting pass shaded.
+    PERF_LINE_PIXELS_TESTED,    // Same two for PutPixelNDC (wireframes and normals).
+    PERF_LINE_PIXELS_WRITTEN,
+    PERF_COUNTER_COUNT
+};
+
+enum PerfStage
+{
+    PERF_STAGE_CLEAR,           // Clearing the color and depth buffers.
+    PERF_STAGE_VERTEX,          // Transform, culling, clipping, shading setup and binning.
+    PERF_STAGE_RASTER,          // Rasterizing the binned triangles.
+    PERF_STAGE_LIGHTING,        // Deferred lighting over the G-buffer, only with SHADE_DEFERRED.
+    PERF_STAGE_PRESENT,         // Filled in by the platform, the application never presents.
+    PERF_STAGE_COUNT
+};
+
+// Names used in reports, as functions so files that never print them don't get unused arrays
+inline const char *
+PerfCounterName(i32 counter)
+{
+    static const char *names[PERF_COUNTER_COUNT] =
+    {
+        "objects_in", "objects_culled", "meshlets_in", "meshlets_outside", "meshlets_backface", "vertices",
+        "triangles_in", "triangles_backface", "triangles_outside", "triangles_clipped", "triangles_split",
+        "triangles_guard_band", "triangles_binned", "pixels_tested", "pixels_written", "hiz_triangles_hidden",
+        "hiz_blocks_hidden", "pixels_lit", "line_pixels_tested", "line_pixels_written"
+    };
+    return names[counter];
+}
+
+inline const char *
+PerfStageName(i32 stage)
+{
+    static const char *names[PERF_STAGE_COUNT] =
+    {
+        "clear", "vertex", "raster", "lighting", "present"
+    };
+    return names[stage];
+}
+
+/*
+24 bytes
+*/
+struct PerfObject
+{
+    u32 objectIndex;            // Into the application's world objects.
+    u32 vertices;
+    u32 trianglesIn;
+    u32 trianglesDrawn;
+    f64 ms;                     // Vertex stage time, rasterization happens later for all objects at once.
+};
+
+struct PerfFrame
+{
+    u64 counters[PERF_COUNTER_COUNT];
+    f64 stageMs[PERF_STAGE_COUNT];
+    std::vector<PerfObject> objects;    // In drawing order.
+};
+
+inline void
+PerfReset(PerfFrame& frame)
+{
+    for (u64& counter : frame.counters) counter = 0;
+    for (f64& ms : frame.stageMs) ms = 0;
+    frame.objects.clear();
+}
+
+inline f64
+PerfMsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Adds the time until the end of the scope to *ms
+struct perf_timed_block
+{
+    f64 *ms;
+    std::chrono::steady_clock::time_point start;
+
+    perf_timed_block(f64 *target) : ms{target}, start{std::chrono::steady_clock::now()} {}
+    ~perf_timed_block() { *ms += PerfMsSince(start); }
+};
+
+#ifdef PERF_ON
+    #define PERF_ONLY(code) code
+    #define PERF_COUNT(frame, counter, n) ((frame).counters[counter] += (n))
+    #define PERF_TIMED_STAGE(frame, stage) perf_timed_block perfStage##stage(&(frame).stageMs[stage])
+#else
+    #define PERF_ONLY(code)
+    #define PERF_COUNT(frame, counter, n)
+    #define PERF_TIMED_STAGE(frame, stage)
+#endif
+
+#endif // PERF_H
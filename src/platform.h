@@ -19,6 +19,8 @@ typedef int64_t i64;
 typedef float f32;
 typedef double f64;
 
+#include "perf.h"
+
 /*
 28 bytes
 */
@@ -43,11 +45,21 @@ enum KeyCode
     KEY_W, KEY_F, KEY_S, KEY_D, KEY_H,
     KEY_G, KEY_Q, KEY_E, KEY_N, KEY_P,
     KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT,
-    KEY_SPACE, KEY_LCTRL,
+    KEY_SPACE, KEY_LCTRL, KEY_A, KEY_C, KEY_V,
+    KEY_L, KEY_Z, KEY_R,
     KEY_0, KEY_1, KEY_2, KEY_3, KEY_4,
     KEY_5, KEY_6, KEY_7, KEY_8, KEY_9
 };
 
+/*
+16 bytes
+*/
+struct RenderStats
+{
+    u64 trianglesDrawn;         // Triangles left after culling and clipping, filled or wireframe.
+    u64 pixelsWritten;          // Filled triangle pixels that passed the depth test.
+};
+
 struct PlatformMouseDevice
 {
     f32 x, y;
@@ -59,6 +71,13 @@ namespace rastertoy
 void UpdateRenderLoop(f32 DeltaTime); // DeltaTime in seconds
 void OnLaunch(PlatformScreenDevice Screen, const std::vector<std::string>& objects);
 void ProcessInput(KeyCode Key);
+void OnShutdown();
+void FinishLoading(); // Blocks until every model passed to OnLaunch is loaded and placed
+void SetLodErrorThreshold(f32 Pixels); // On screen error allowed when picking levels of detail, 0 always draws full meshes. Reset by OnLaunch.
+void SetMeshCache(bool Enabled); // Whether models are read from and written to .rtmesh caches, on by default. Call before OnLaunch.
+RenderStats LastFrameStats(); // Of the last UpdateRenderLoop
+const PerfFrame& LastFramePerf(); // Of the last UpdateRenderLoop, all zeros without PERF_ON
+f64 LoadParseMs(); // Spent parsing OBJ files for the models placed since OnLaunch, cached models add nothing
 }
 
 // For the platform to implement ---------------------------------------------------------------
@@ -0,0 +1,642 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include "math.h"
+#include "perf.h"
+#include "simd.h"
+
+#include <type_traits>
+
+/*
+NOTE: Triangles are rasterized with edge functions in 28.4 fixed point screen space.
+Pixels are sampled at their centers and the top-left fill rule decides who owns a pixel
+that lies exactly on a shared edge, so neighbouring triangles neither leave gaps nor
+write the same pixel twice.
+
+Attributes are set up once per triangle as plane equations (value + d/dx + d/dy) so the
+pixel loop only does adds and multiplies, no divisions.
+
+Rows are walked in spans of SIMD_WIDTH pixels that start on a multiple of SIMD_WIDTH. Coverage,
+1/z and the depth test are evaluated for the whole span at once.
+
+A coarse depth hierarchy keeps the smallest and largest 1/z of every RASTER_HIZ_BLOCK square.
+Bounding the triangle's 1/z plane over a block is enough to skip the block when it is
+completely hidden, or the per-pixel depth loads when it is completely in front. Triangles that
+are hidden in every block they touch are dropped before their attributes are set up.
+
+For expensive shaders the same triangles can be drawn twice: RASTER_DEPTH_ONLY lays down the
+final depth buffer without shading anything, then RASTER_DEPTH_EQUAL shades only the pixels
+whose depth matches. Both passes step 1/z with the same arithmetic so the match is exact, and
+each visible pixel is shaded once however much overdraw there is.
+
+Deferred shading draws into a G-buffer instead: the color buffer gets the base color and shaders
+with WritesNormal also leave their view space normal in normalBuffer, to be lit later.
+*/
+
+const i32 RASTER_SUBPIXEL_BITS = 4;
+const f32 RASTER_SUBPIXEL_SCALE = static_cast<f32>(1 << RASTER_SUBPIXEL_BITS);
+
+// Vertices have to stay within this many pixels of the screen center for the edge
+// functions to fit in 32 bits. Triangles reaching further out get clipped in screen space.
+const f32 RASTER_GUARD_BAND = 2048.0f;
+
+const i32 RASTER_MAX_ATTRIBUTES = 8;
+
+const i32 RASTER_HIZ_BITS = 3;
+const i32 RASTER_HIZ_BLOCK = 1 << RASTER_HIZ_BITS;     // Pixels per side of a depth hierarchy block, a multiple of SIMD_WIDTH.
+const f32 RASTER_HIZ_EPSILON = 1e-5f;                   // Relative slack for 1/z bounds versus 1/z stepped across the triangle.
+
+/*
+12 bytes
+*/
+struct raster_hiz_block
+{
+    f32 minInvZ;    // Farthest depth in the block, anything not in front of it is hidden.
+    f32 maxInvZ;    // At least the nearest depth in the block.
+    i32 writes;     // Pixels written since minInvZ was last read back from the depth buffer.
+};
+
+// What a draw does with the depth buffer
+enum raster_depth_mode
+{
+    RASTER_DEPTH_TEST,      // Shade pixels in front of the depth buffer and store their depth.
+    RASTER_DEPTH_ONLY,      // Only store the depth of pixels in front, nothing is shaded.
+    RASTER_DEPTH_EQUAL      // Shade pixels whose depth is already in the buffer, the depth is left alone.
+};
+
+/*
+Where the rasterizer writes to. Only pixels inside [minX, maxX) x [minY, maxY) are touched.
+minX has to be a multiple of SIMD_WIDTH, spans are read and written back whole.
+*/
+struct raster_target
+{
+    u32 *colorBuffer;
+    f32 *depthBuffer;
+    vec3f *normalBuffer;        // Only written by shaders with WritesNormal.
+    raster_hiz_block *hiz;      // hizColumns blocks per row of blocks, nullptr to go without.
+    i32 hizColumns;
+    i32 width;
+    i32 height;
+    i32 minX, minY;
+    i32 maxX, maxY;
+    raster_depth_mode depthMode;
+};
+
+/*
+16 bytes
+*/
+struct raster_counts
+{
+    i32 tested;         // Covered pixels that went through the depth test, only counted with PERF_ON.
+    i32 written;        // Pixels that passed it.
+    i32 hidden;         // Triangles the depth hierarchy dropped before setup, only counted with PERF_ON.
+    i32 hiddenBlocks;   // Blocks the depth hierarchy skipped in the triangles that were drawn, same.
+};
+
+// Reads the block's depth range back from the depth buffer
+inline void
+RefreshHiZBlock(const raster_target& target, i32 blockX, i32 blockY)
+{
+    raster_hiz_block& block = target.hiz[blockY * target.hizColumns + blockX];
+    const i32 x0 = blockX << RASTER_HIZ_BITS;
+    const i32 y0 = blockY << RASTER_HIZ_BITS;
+    const i32 x1 = std::min(x0 + RASTER_HIZ_BLOCK, target.width);
+    const i32 y1 = std::min(y0 + RASTER_HIZ_BLOCK, target.height);
+
+    f32 minInvZ = target.depthBuffer[y0 * target.width + x0];
+    f32 maxInvZ = minInvZ;
+    for (i32 y = y0; y < y1; ++y)
+    {
+        const f32 *depthRow = target.depthBuffer + y * target.width;
+        for (i32 x = x0; x < x1; ++x)
+        {
+            minInvZ = std::min(minInvZ, depthRow[x]);
+            maxInvZ = std::max(maxInvZ, depthRow[x]);
+        }
+    }
+    block.minInvZ = minInvZ;
+    block.maxInvZ = maxInvZ;
+    block.writes = 0;
+}
+
+// Rebuilds the blocks of [minX, maxX) x [minY, maxY), which have to be whole blocks or end at the buffer's edge
+inline void
+RefreshHiZ(const raster_target& target)
+{
+    for (i32 blockY = target.minY >> RASTER_HIZ_BITS; blockY << RASTER_HIZ_BITS < target.maxY; ++blockY)
+    {
+        for (i32 blockX = target.minX >> RASTER_HIZ_BITS; blockX << RASTER_HIZ_BITS < target.maxX; ++blockX)
+        {
+            RefreshHiZBlock(target, blockX, blockY);
+        }
+    }
+}
+
+// Records pixels written into the block at (x, y) with 1/z up to invZ. The farthest depth only
+// gets read back once the block has seen as many writes as it has pixels.
+inline void
+HiZWritten(const raster_target& target, i32 x, i32 y, i32 count, f32 invZ)
+{
+    const i32 blockX = x >> RASTER_HIZ_BITS;
+    const i32 blockY = y >> RASTER_HIZ_BITS;
+    raster_hiz_block& block = target.hiz[blockY * target.hizColumns + blockX];
+    block.maxInvZ = std::max(block.maxInvZ, invZ);
+    block.writes += count;
+    if (block.writes >= RASTER_HIZ_BLOCK * RASTER_HIZ_BLOCK)
+    {
+        RefreshHiZBlock(target, blockX, blockY);
+    }
+}
+
+/*
+44 bytes
+*/
+struct raster_vertex
+{
+    vec2f screen;                           // Position in pixels, y pointing down.
+    f32 invZ;                               // 1/z, linear in screen space.
+    f32 attributes[RASTER_MAX_ATTRIBUTES];  // Whatever the pixel shader needs interpolated.
+};
+
+/*
+A pixel shader is any type providing:
+    static const i32 AttributeCount;                    // How many attributes to interpolate.
+    static const bool IsWide;                           // Whether ShadeWide is implemented.
+    static const bool WritesNormal;                     // Whether Normal is implemented.
+    u32 Shade(const f32 *attributes, f32 invZ) const;   // Returns the packed pixel color.
+    simd_i32 ShadeWide(const simd_f32 *attributes, simd_f32 invZ) const; // Same for a span.
+    vec3f Normal(const f32 *attributes) const;          // Stored in the target's normalBuffer.
+Shaders that aren't wide still get their coverage and depth test done a span at a time and are
+then called once per visible pixel. Shaders that write normals can't be wide.
+*/
+
+inline bool
+IsTopLeftEdge(i32 a, i32 b)
+{
+    // Inward normal is (a, b) with y down. Left edges point right, top edges point down.
+    return a > 0 || (a == 0 && b > 0);
+}
+
+inline raster_vertex
+lerp_raster_vertex(const raster_vertex& v0, const raster_vertex& v1, f32 t)
+{
+    raster_vertex result;
+    result.screen = v0.screen + t * (v1.screen - v0.screen);
+    result.invZ = v0.invZ + t * (v1.invZ - v0.invZ);
+    for (i32 i = 0; i < RASTER_MAX_ATTRIBUTES; ++i)
+    {
+        result.attributes[i] = v0.attributes[i] + t * (v1.attributes[i] - v0.attributes[i]);
+    }
+    return result;
+}
+
+template <typename pixel_shader>
+inline void
+StoreNormal(const pixel_shader& shader, vec3f *normal, const f32 *attributes, std::true_type /* writes normal */)
+{
+    *normal = shader.Normal(attributes);
+}
+
+template <typename pixel_shader>
+inline void
+StoreNormal(const pixel_shader& /*shader*/, vec3f * /*normal*/, const f32 * /*attributes*/, std::false_type /* writes normal */)
+{
+}
+
+template <typename pixel_shader>
+inline void
+ShadePixel(const pixel_shader& shader, u32 *color, f32 *depth, vec3f *normal, f32 invZ,
+           const f32 *attributeRow, const f32 *attributeDx, f32 dx)
+{
+    const i32 N = pixel_shader::AttributeCount;
+    f32 attributes[N > 0 ? N : 1];
+    for (i32 i = 0; i < N; ++i)
+    {
+        attributes[i] = attributeRow[i] + attributeDx[i] * dx;
+    }
+
+    *depth = invZ;
+    *color = shader.Shade(attributes, invZ);
+    StoreNormal(shader, normal, attributes, std::integral_constant<bool, pixel_shader::WritesNormal>());
+}
+
+// Shades and stores every lane of a span that passed the depth test
+template <typename pixel_shader>
+inline void
+ShadeSpan(const pixel_shader& shader, u32 *color, f32 *depth, vec3f * /*normal*/, simd_i32 passed, simd_f32 invZ,
+          const f32 *attributeRow, const f32 *attributeDx, f32 dx, std::true_type /* wide */)
+{
+    static_assert(!pixel_shader::WritesNormal, "Shaders that write normals are shaded a pixel at a time");
+    const i32 N = pixel_shader::AttributeCount;
+    const simd_f32 dxs = simd_ramp_f32(dx, 1.0f);
+    simd_f32 attributes[N > 0 ? N : 1];
+    for (i32 i = 0; i < N; ++i)
+    {
+        attributes[i] = simd_add_f32(simd_set1_f32(attributeRow[i]), simd_mul_f32(simd_set1_f32(attributeDx[i]), dxs));
+    }
+
+    simd_i32 shaded = shader.ShadeWide(attributes, invZ);
+    simd_storeu_i32(color, simd_select_i32(passed, shaded, simd_loadu_i32(color)));
+    simd_storeu_f32(depth, simd_select_f32(passed, invZ, simd_loadu_f32(depth)));
+}
+
+template <typename pixel_shader>
+inline void
+ShadeSpan(const pixel_shader& shader, u32 *color, f32 *depth, vec3f *normal, simd_i32 passed, simd_f32 invZ,
+          const f32 *attributeRow, const f32 *attributeDx, f32 dx, std::false_type /* wide */)
+{
+    f32 invZLanes[SIMD_WIDTH];
+    simd_storeu_f32(invZLanes, invZ);
+
+    const i32 bits = simd_mask_bits(passed);
+    for (i32 lane = 0; lane < SIMD_WIDTH; ++lane)
+    {
+        if (bits & (1 << lane))
+        {
+            ShadePixel(shader, color + lane, depth + lane, normal + lane, invZLanes[lane], attributeRow, attributeDx, dx + lane);
+        }
+    }
+}
+
+template <raster_depth_mode Mode, typename pixel_shader>
+static raster_counts
+RasterizeTriangleFixed(const raster_target& target,
+                       const raster_vertex& v0, const raster_vertex& v1, const raster_vertex& v2,
+                       const pixel_shader& shader)
+{
+    // A depth only pass has nothing to interpolate
+    const i32 N = Mode == RASTER_DEPTH_ONLY ? 0 : pixel_shader::AttributeCount;
+
+    // Snap to 28.4, shifted half a pixel so that pixel centers land on integers.
+    i32 x0 = static_cast<i32>(std::lrint((v0.screen.x - 0.5f) * RASTER_SUBPIXEL_SCALE));
+    i32 y0 = static_cast<i32>(std::lrint((v0.screen.y - 0.5f) * RASTER_SUBPIXEL_SCALE));
+    i32 x1 = static_cast<i32>(std::lrint((v1.screen.x - 0.5f) * RASTER_SUBPIXEL_SCALE));
+    i32 y1 = static_cast<i32>(std::lrint((v1.screen.y - 0.5f) * RASTER_SUBPIXEL_SCALE));
+    i32 x2 = static_cast<i32>(std::lrint((v2.screen.x - 0.5f) * RASTER_SUBPIXEL_SCALE));
+    i32 y2 = static_cast<i32>(std::lrint((v2.screen.y - 0.5f) * RASTER_SUBPIXEL_SCALE));
+
+    const raster_vertex *p0 = &v0;
+    const raster_vertex *p1 = &v1;
+    const raster_vertex *p2 = &v2;
+
+    i64 area = static_cast<i64>(x1 - x0) * (y2 - y0) - static_cast<i64>(y1 - y0) * (x2 - x0);
+    if (area == 0)
+    {
+        return {};
+    }
+
+    // Accept both windings, the edge functions want a positive area
+    if (area < 0)
+    {
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+        std::swap(p1, p2);
+        area = -area;
+    }
+
+    // Bounding box in pixels clamped to the scissor rectangle
+    i32 minX = (std::min(x0, std::min(x1, x2)) + (1 << RASTER_SUBPIXEL_BITS) - 1) >> RASTER_SUBPIXEL_BITS;
+    i32 minY = (std::min(y0, std::min(y1, y2)) + (1 << RASTER_SUBPIXEL_BITS) - 1) >> RASTER_SUBPIXEL_BITS;
+    i32 maxX = (std::max(x0, std::max(x1, x2)) >> RASTER_SUBPIXEL_BITS) + 1;
+    i32 maxY = (std::max(y0, std::max(y1, y2)) >> RASTER_SUBPIXEL_BITS) + 1;
+
+    minX = std::max(minX, target.minX);
+    minY = std::max(minY, target.minY);
+    maxX = std::min(maxX, target.maxX);
+    maxY = std::min(maxY, target.maxY);
+
+    if (minX >= maxX || minY >= maxY)
+    {
+        return {};
+    }
+
+    // Start spans on a SIMD_WIDTH boundary, the extra pixels on the left are outside the triangle
+    minX &= ~(SIMD_WIDTH - 1);
+
+    // Edge function for edge a->b: E(p) = A * p.x + B * p.y + C, w0 is opposite of v0 etc.
+    i32 A12 = y1 - y2, B12 = x2 - x1;
+    i32 A20 = y2 - y0, B20 = x0 - x2;
+    i32 A01 = y0 - y1, B01 = x1 - x0;
+
+    i64 C12 = static_cast<i64>(x1) * y2 - static_cast<i64>(y1) * x2;
+    i64 C20 = static_cast<i64>(x2) * y0 - static_cast<i64>(y2) * x0;
+    i64 C01 = static_cast<i64>(x0) * y1 - static_cast<i64>(y0) * x1;
+
+    // Evaluate at the first pixel center in 24.8, apply the fill rule bias and drop the 4 bits
+    // that the integer pixel steps can never reach. Only the sign matters so this is exact.
+    i64 sampleX = static_cast<i64>(minX) << RASTER_SUBPIXEL_BITS;
+    i64 sampleY = static_cast<i64>(minY) << RASTER_SUBPIXEL_BITS;
+    i32 w0Row = static_cast<i32>((A12 * sampleX + B12 * sampleY + C12 + (IsTopLeftEdge(A12, B12) ? 0 : -1)) >> RASTER_SUBPIXEL_BITS);
+    i32 w1Row = static_cast<i32>((A20 * sampleX + B20 * sampleY + C20 + (IsTopLeftEdge(A20, B20) ? 0 : -1)) >> RASTER_SUBPIXEL_BITS);
+    i32 w2Row = static_cast<i32>((A01 * sampleX + B01 * sampleY + C01 + (IsTopLeftEdge(A01, B01) ? 0 : -1)) >> RASTER_SUBPIXEL_BITS);
+
+    // Attribute plane equations, in pixel units relative to the first pixel center
+    const f32 invArea = RASTER_SUBPIXEL_SCALE * RASTER_SUBPIXEL_SCALE / static_cast<f32>(area);
+    const f32 e1x = (x1 - x0) / RASTER_SUBPIXEL_SCALE, e1y = (y1 - y0) / RASTER_SUBPIXEL_SCALE;
+    const f32 e2x = (x2 - x0) / RASTER_SUBPIXEL_SCALE, e2y = (y2 - y0) / RASTER_SUBPIXEL_SCALE;
+    const f32 originX = minX - x0 / RASTER_SUBPIXEL_SCALE;
+    const f32 originY = minY - y0 / RASTER_SUBPIXEL_SCALE;
+
+    f32 d1 = p1->invZ - p0->invZ;
+    f32 d2 = p2->invZ - p0->invZ;
+    const f32 invZdx = (d1 * e2y - d2 * e1y) * invArea;
+    const f32 invZdy = (d2 * e1x - d1 * e2x) * invArea;
+    f32 invZRow = p0->invZ + invZdx * originX + invZdy * originY;
+
+    // Range of the 1/z plane over the pixel centers of [x0, x1) x [y0, y1). Covered pixels never
+    // go past the vertices' range, which tightens it where the plane runs on outside the triangle.
+    const f32 triangleMinInvZ = std::min(p0->invZ, std::min(p1->invZ, p2->invZ));
+    const f32 triangleMaxInvZ = std::max(p0->invZ, std::max(p1->invZ, p2->invZ));
+    const f32 invZOrigin = invZRow;
+    auto invZRange = [&](i32 blockX0, i32 blockY0, i32 blockX1, i32 blockY1, f32& lowest, f32& highest)
+    {
+        const f32 corner = invZOrigin + invZdx * (blockX0 - minX) + invZdy * (blockY0 - minY);
+        const f32 acrossX = invZdx * (blockX1 - 1 - blockX0);
+        const f32 acrossY = invZdy * (blockY1 - 1 - blockY0);
+        lowest = std::max(corner + std::min(acrossX, 0.0f) + std::min(acrossY, 0.0f), triangleMinInvZ);
+        highest = std::min(corner + std::max(acrossX, 0.0f) + std::max(acrossY, 0.0f), triangleMaxInvZ);
+    };
+
+    const bool useHiZ = target.hiz != nullptr;
+    const i32 firstBlockX = minX >> RASTER_HIZ_BITS;
+    raster_counts counts = {};
+    if (useHiZ)
+    {
+        bool visible = false;
+        for (i32 blockY = minY >> RASTER_HIZ_BITS; !visible && blockY << RASTER_HIZ_BITS < maxY; ++blockY)
+        {
+            for (i32 blockX = firstBlockX; !visible && blockX << RASTER_HIZ_BITS < maxX; ++blockX)
+            {
+                f32 lowest, highest;
+                invZRange(std::max(blockX << RASTER_HIZ_BITS, minX), std::max(blockY << RASTER_HIZ_BITS, minY),
+                          std::min((blockX + 1) << RASTER_HIZ_BITS, maxX), std::min((blockY + 1) << RASTER_HIZ_BITS, maxY),
+                          lowest, highest);
+                visible = highest * (1 + RASTER_HIZ_EPSILON) > target.hiz[blockY * target.hizColumns + blockX].minInvZ;
+            }
+        }
+
+        if (!visible)
+        {
+            PERF_ONLY(counts.hidden = 1);
+            return counts;
+        }
+    }
+
+    f32 attributeDx[N > 0 ? N : 1];
+    f32 attributeDy[N > 0 ? N : 1];
+    f32 attributeRow[N > 0 ? N : 1];
+    for (i32 i = 0; i < N; ++i)
+    {
+        d1 = p1->attributes[i] - p0->attributes[i];
+        d2 = p2->attributes[i] - p0->attributes[i];
+        attributeDx[i] = (d1 * e2y - d2 * e1y) * invArea;
+        attributeDy[i] = (d2 * e1x - d1 * e2x) * invArea;
+        attributeRow[i] = p0->attributes[i] + attributeDx[i] * originX + attributeDy[i] * originY;
+    }
+
+    const simd_i32 minusOne = simd_set1_i32(-1);
+    const simd_i32 w0Step = simd_set1_i32(A12 * SIMD_WIDTH);
+    const simd_i32 w1Step = simd_set1_i32(A20 * SIMD_WIDTH);
+    const simd_i32 w2Step = simd_set1_i32(A01 * SIMD_WIDTH);
+    const std::integral_constant<bool, pixel_shader::IsWide> wide;
+
+    // Spans that would run past the scissor rectangle are finished one pixel at a time
+    const i32 spanEnd = std::min(maxX, target.maxX - SIMD_WIDTH + 1);
+
+    // The first 64 blocks of the current row of blocks, the ones further right are never skipped
+    u64 hiddenBlocks = 0;
+    u64 frontBlocks = 0;
+    f32 blockMaxInvZ[64];
+    auto blockBit = [&](i32 x) -> u64
+    {
+        const i32 bit = (x >> RASTER_HIZ_BITS) - firstBlockX;
+        return bit < 64 ? static_cast<u64>(1) << bit : 0;
+    };
+    auto blockBound = [&](i32 x) -> f32
+    {
+        const i32 bit = (x >> RASTER_HIZ_BITS) - firstBlockX;
+        return bit < 64 ? blockMaxInvZ[bit] : triangleMaxInvZ;
+    };
+
+    for (i32 y = minY; y < maxY; ++y)
+    {
+        u32 *colorRow = target.colorBuffer + y * target.width;
+        f32 *depthRow = target.depthBuffer + y * target.width;
+        vec3f *normalRow = target.normalBuffer + y * target.width;
+
+        if (useHiZ && (y == minY || (y & (RASTER_HIZ_BLOCK - 1)) == 0))
+        {
+            const i32 blockY = y >> RASTER_HIZ_BITS;
+            const i32 blockY1 = std::min((blockY + 1) << RASTER_HIZ_BITS, maxY);
+            hiddenBlocks = 0;
+            frontBlocks = 0;
+            for (i32 bit = 0; bit < 64 && (firstBlockX + bit) << RASTER_HIZ_BITS < maxX; ++bit)
+            {
+                const i32 blockX = firstBlockX + bit;
+                const raster_hiz_block& block = target.hiz[blockY * target.hizColumns + blockX];
+                f32 lowest;
+                invZRange(std::max(blockX << RASTER_HIZ_BITS, minX), y, std::min((blockX + 1) << RASTER_HIZ_BITS, maxX), blockY1,
+                          lowest, blockMaxInvZ[bit]);
+                if (blockMaxInvZ[bit] * (1 + RASTER_HIZ_EPSILON) <= block.minInvZ)
+                {
+                    hiddenBlocks |= static_cast<u64>(1) << bit;
+                    PERF_ONLY(++counts.hiddenBlocks);
+                }
+                else if (Mode != RASTER_DEPTH_EQUAL && lowest * (1 - RASTER_HIZ_EPSILON) > block.maxInvZ)
+                {
+                    frontBlocks |= static_cast<u64>(1) << bit;
+                }
+            }
+        }
+
+        simd_i32 w0 = simd_ramp_i32(w0Row, A12);
+        simd_i32 w1 = simd_ramp_i32(w1Row, A20);
+        simd_i32 w2 = simd_ramp_i32(w2Row, A01);
+
+        i32 x = minX;
+        for (; x < spanEnd; x += SIMD_WIDTH)
+        {
+            // Spans never straddle blocks
+            const u64 block = blockBit(x);
+            simd_i32 covered = simd_cmpgt_i32(simd_or_i32(simd_or_i32(w0, w1), w2), minusOne);
+            if (!(hiddenBlocks & block) && simd_mask_bits(covered))
+            {
+                PERF_ONLY(counts.tested += simd_mask_count(covered));
+                const f32 dx = static_cast<f32>(x - minX);
+                simd_f32 invZ = simd_ramp_f32(invZRow + invZdx * dx, invZdx);
+                simd_i32 passed = (frontBlocks & block) ? covered
+                                : Mode == RASTER_DEPTH_EQUAL ? simd_and_i32(covered, simd_cmpeq_f32(invZ, simd_loadu_f32(depthRow + x)))
+                                                             : simd_and_i32(covered, simd_cmpgt_f32(invZ, simd_loadu_f32(depthRow + x)));
+                if (simd_mask_bits(passed))
+                {
+                    const i32 written = simd_mask_count(passed);
+                    counts.written += written;
+                    if (Mode == RASTER_DEPTH_ONLY)
+                    {
+                        simd_storeu_f32(depthRow + x, simd_select_f32(passed, invZ, simd_loadu_f32(depthRow + x)));
+                    }
+                    else
+                    {
+                        // Storing an equal depth back leaves the buffer as it was
+                        ShadeSpan(shader, colorRow + x, depthRow + x, normalRow + x, passed, invZ, attributeRow, attributeDx, dx, wide);
+                    }
+                    if (useHiZ && Mode != RASTER_DEPTH_EQUAL)
+                    {
+                        HiZWritten(target, x, y, written, blockBound(x));
+                    }
+                }
+            }
+
+            w0 = simd_add_i32(w0, w0Step);
+            w1 = simd_add_i32(w1, w1Step);
+            w2 = simd_add_i32(w2, w2Step);
+        }
+
+        for (; x < maxX; ++x)
+        {
+            const i32 offset = x - minX;
+            if (!(hiddenBlocks & blockBit(x)) && ((w0Row + A12 * offset) | (w1Row + A20 * offset) | (w2Row + A01 * offset)) >= 0)
+            {
+                const f32 dx = static_cast<f32>(offset);
+                const f32 invZ = invZRow + invZdx * dx;
+                PERF_ONLY(++counts.tested);
+                if (Mode == RASTER_DEPTH_EQUAL ? invZ == depthRow[x] : invZ > depthRow[x])
+                {
+                    ++counts.written;
+                    if (Mode == RASTER_DEPTH_ONLY)
+                    {
+                        depthRow[x] = invZ;
+                    }
+                    else
+                    {
+                        ShadePixel(shader, colorRow + x, depthRow + x, normalRow + x, invZ, attributeRow, attributeDx, dx);
+                    }
+                    if (useHiZ && Mode != RASTER_DEPTH_EQUAL)
+                    {
+                        HiZWritten(target, x, y, 1, blockBound(x));
+                    }
+                }
+            }
+        }
+
+        w0Row += B12;
+        w1Row += B20;
+        w2Row += B01;
+        invZRow += invZdy;
+        for (i32 i = 0; i < N; ++i)
+        {
+            attributeRow[i] += attributeDy[i];
+        }
+    }
+    return counts;
+}
+
+/*
+Sutherland-Hodgman against the guard band rectangle. Everything we interpolate is linear in
+screen space so clipping here keeps the attributes exact.
+*/
+static i32
+ClipPolygonToGuardBand(const raster_target& target, raster_vertex *polygon, i32 count)
+{
+    const f32 centerX = 0.5f * target.width;
+    const f32 centerY = 0.5f * target.height;
+    const f32 bounds[4] =
+    {
+        centerX - RASTER_GUARD_BAND, // left
+        centerX + RASTER_GUARD_BAND, // right
+        centerY - RASTER_GUARD_BAND, // top
+        centerY + RASTER_GUARD_BAND  // bottom
+    };
+
+    raster_vertex scratch[9];
+    for (i32 side = 0; side < 4 && count >= 3; ++side)
+    {
+        const bool vertical = side < 2;
+        const f32 sign = (side & 1) ? -1.0f : 1.0f;
+
+        i32 outCount = 0;
+        for (i32 i = 0; i < count; ++i)
+        {
+            const raster_vertex& a = polygon[i];
+            const raster_vertex& b = polygon[(i + 1) % count];
+            f32 da = sign * ((vertical ? a.screen.x : a.screen.y) - bounds[side]);
+            f32 db = sign * ((vertical ? b.screen.x : b.screen.y) - bounds[side]);
+
+            if (da >= 0)
+            {
+                scratch[outCount++] = a;
+            }
+            if ((da >= 0) != (db >= 0))
+            {
+                // Always step from the inside vertex so a shared edge clips to the same point
+                scratch[outCount++] = (da >= 0) ? lerp_raster_vertex(a, b, da / (da - db))
+                                                : lerp_raster_vertex(b, a, db / (db - da));
+            }
+        }
+
+        std::copy(scratch, scratch + outCount, polygon);
+        count = outCount;
+    }
+    return count;
+}
+
+// Picks the target's depth mode once per triangle rather than once per span
+template <typename pixel_shader>
+static raster_counts
+RasterizeTriangleInMode(const raster_target& target,
+                        const raster_vertex& v0, const raster_vertex& v1, const raster_vertex& v2,
+                        const pixel_shader& shader)
+{
+    switch (target.depthMode)
+    {
+        case RASTER_DEPTH_ONLY:
+            return RasterizeTriangleFixed<RASTER_DEPTH_ONLY>(target, v0, v1, v2, shader);
+        case RASTER_DEPTH_EQUAL:
+            return RasterizeTriangleFixed<RASTER_DEPTH_EQUAL>(target, v0, v1, v2, shader);
+        default:
+            return RasterizeTriangleFixed<RASTER_DEPTH_TEST>(target, v0, v1, v2, shader);
+    }
+}
+
+template <typename pixel_shader>
+static raster_counts
+RasterizeTriangle(const raster_target& target,
+                  const raster_vertex& v0, const raster_vertex& v1, const raster_vertex& v2,
+                  const pixel_shader& shader)
+{
+    const f32 centerX = 0.5f * target.width;
+    const f32 centerY = 0.5f * target.height;
+
+    bool inside = true;
+    const raster_vertex *vertices[3] = { &v0, &v1, &v2 };
+    for (auto v : vertices)
+    {
+        if (!std::isfinite(v->screen.x) || !std::isfinite(v->screen.y) || !std::isfinite(v->invZ))
+        {
+            return {};
+        }
+        inside = inside && std::fabs(v->screen.x - centerX) <= RASTER_GUARD_BAND
+                        && std::fabs(v->screen.y - centerY) <= RASTER_GUARD_BAND;
+    }
+
+    if (inside)
+    {
+        return RasterizeTriangleInMode(target, v0, v1, v2, shader);
+    }
+
+    // A triangle clipped by 4 lines has at most 7 vertices
+    raster_vertex polygon[9] = { v0, v1, v2 };
+    i32 count = ClipPolygonToGuardBand(target, polygon, 3);
+    raster_counts counts = {};
+    for (i32 i = 1; i + 1 < count; ++i)
+    {
+        raster_counts part = RasterizeTriangleInMode(target, polygon[0], polygon[i], polygon[i + 1], shader);
+        counts.tested += part.tested;
+        counts.written += part.written;
+        counts.hidden += part.hidden;
+        counts.hiddenBlocks += part.hiddenBlocks;
+    }
+    return counts;
+}
+
+#endif // RASTERIZER_H
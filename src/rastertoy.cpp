@@ -4,10 +4,17 @@
 #include "object3d.h"
 #include "camera.h"
 #include "lighting.h"
+#include "rasterizer.h"
+#include "tiles.h"
+#include "worker_pool.h"
+#include "mpsc_queue.h"
 
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
 #include <algorithm>
 
 namespace rastertoy
@@ -23,21 +30,106 @@ enum ShadingOption
 {
     SHADE_FLAT,
     SHADE_GOURAUD,
-    SHADE_PHONG
+    SHADE_PHONG,
+    SHADE_PHONG_PREPASS,    // Phong after a depth only pass, so every visible pixel is lit once.
+    SHADE_DEFERRED          // Phong as a pass over a G-buffer, which is kept while only the light moves.
+};
+
+/*
+40 bytes
+*/
+struct screen_vertex
+{
+    vertex3 view;   // View space vertex.
+    vec3f screen;   // Position on screen in pixels and 1/z.
+};
+
+/*
+Post-transform vertex cache. Every vertex of the object being drawn that a visible meshlet uses is
+transformed and projected once, triangle assembly then indexes these arrays the same way it
+indexes the model.
+*/
+struct vertex_cache
+{
+    std::vector<vec3f> positions;   // View space, indexed like Model3D::Vertices.
+    std::vector<vec3f> normals;     // View space.
+    std::vector<vec3f> screen;      // Pixels and 1/z, only valid when GuardBandClipPlanes of the outcode is 0.
+    std::vector<u16> outcodes;      // ClipOutcode of the position, the planes it is outside of.
+    std::vector<u32> drawn;         // The draw that processed the vertex, only the current one's are valid.
+    u32 draw = 0;                   // Current draw, bumped for every object.
+    mat4x4 packedView;              // Packed models' dequantization followed by modelView.
+};
+
+/*
+24 bytes
+*/
+struct visible_object
+{
+    Object3D *object;
+    f32 depth;      // View space depth of the nearest point of the bounding sphere.
+    u32 batch;      // Rank of the object's model, by its nearest visible instance.
+    u32 index;      // Into worldObjects.
+};
+
+// A command line entry, "model.obj:N" asks for N instances of the model
+struct pending_load
+{
+    std::string name;
+    i32 instances;
+};
+
+// Handed from a loader thread to the render thread
+struct loaded_model
+{
+    u32 file;           // Into globalLoadFiles.
+    Model3D *model;     // nullptr when the file couldn't be loaded.
+    f64 parseMs;        // Spent in ParseOBJ, 0 when the model came from its cache.
+};
+
+struct assembled_triangles
+{
+    // Convex, {0 1 2} when nothing was clipped and a fan around v[0] when it was
+    screen_vertex v[MAX_CLIPPED_VERTICES];
+    u32 count;
+    bool IsIn;
 };
 
 // GLOBAL VARIABLES  --------------------------------------------------------------------
 static PlatformScreenDevice globalScreenDevice;
 static f32 *globalDepthBuffer;
+static std::vector<u32> globalBaseColorBuffer;          // G-buffer for SHADE_DEFERRED, with globalDepthBuffer.
+static std::vector<vec3f> globalNormalBuffer;           // View space, zero where no triangle was drawn.
+static std::vector<raster_hiz_block> globalHiZ;         // Depth hierarchy over globalDepthBuffer, see RASTER_HIZ_BLOCK.
+static screen_tiles globalTiles;
+static worker_pool globalWorkers;
+static vertex_cache globalVertexCache;
+static std::vector<visible_object> globalVisibleObjects;
+static std::unordered_map<const Model3D *, u32> globalModelBatches;
 static f32 globalDeltaTime;
 static std::vector<Object3D *> worldObjects;
 static camera globalCamera;
+static vec2f globalGuardBand;                           // RASTER_GUARD_BAND in NDC units, see ClipOutcode.
 static RenderOption globalRenderMode;
 static ShadingOption globalShadingMode;
+static bool globalSceneChanged = true;                  // Anything but the light moved since the last frame.
 static point_light globalOmniLight;
 static ambient_light globalAmbientLight;
 static u8 globalObjectCursor = 0;
 static bool globalRenderNormals = false;
+static bool globalRenderScene = false;
+static std::atomic<bool> globalPackModels(false);       // Models are kept packed, see PackModel. Read by the loader threads.
+static f32 globalLodErrorPixels = 1.0f;                 // On screen error allowed for a level of detail, 0 always draws the full mesh.
+static bool globalUseMeshCache = true;                  // Models go through .rtmesh caches, see mesh_cache_header.
+static std::vector<pending_load> globalPendingLoads;    // Entries whose model hasn't arrived yet.
+static std::vector<std::string> globalLoadFiles;        // Distinct files, read by the loader threads.
+static std::atomic<u32> globalNextLoadFile;
+static std::vector<std::thread> globalLoaders;
+static mpsc_queue<loaded_model> globalLoadedModels;
+static u32 globalLoadsInFlight = 0;                     // Files not handed back yet, render thread only.
+static i32 globalPlacementRow = 0;                      // First free row of the instance grid, see PlaceInstances.
+static f64 globalLoadParseMs = 0.0;                     // Summed parseMs of the models handed back since OnLaunch.
+static RenderStats globalFrameStats;
+static PerfFrame globalPerf;
 static const std::string globalHelpString = 
 "\n\nControls:\n"
 "[View Modes]\n"
@@ -49,8 +141,13 @@ static const std::string globalHelpString =
 "   f - for flat shading.\n"
 "   g - for Gouraud shading.\n"
 "   p - for Phong shading.\n"
+"   z - for Phong shading after a depth prepass, lights each visible pixel once.\n"
+"   r - for deferred Phong shading, moving only the light doesn't redraw the models.\n"
 "[Toggles]\n"
 "   n - to toggle vertex normals.\n"
+"   c - to store models compactly (quantized positions and normals).\n"
+"   v - to store models at full precision.\n"
+"   l - to cycle the level of detail error (1, 2, 4 pixels, off, 0.5 pixels).\n"
 "[Movements]\n"
 "   q - to rotate current model to the left.\n"
 "   e - to rotate current model to the right.\n"
@@ -59,6 +156,7 @@ static const std::string globalHelpString =
 "   up/down/left/right - to move light source.\n"
 "[Model selection]\n"
 "   0 to 9 - to select models that have been loaded.\n"
+"   a - to view every loaded model at once.\n"
 "\nPress H to see this again.\n\n"
 ;
 
@@ -89,8 +187,10 @@ PutPixelNDC(vertex2 vertex, f32 z_value)
     u32 *tempBuffer = (u32 *) globalScreenDevice.BufferMemory;
     u32 index = globalScreenDevice.width * static_cast<int>(vertex.point.y) + static_cast<int>(vertex.point.x);
 
+    PERF_COUNT(globalPerf, PERF_LINE_PIXELS_TESTED, 1);
     if (z_value > globalDepthBuffer[index])
     {
+        PERF_COUNT(globalPerf, PERF_LINE_PIXELS_WRITTEN, 1);
         tempBuffer[index] = color_uint32(vertex.color);
         globalDepthBuffer[index] = z_value;
     }
@@ -98,31 +198,91 @@ PutPixelNDC(vertex2 vertex, f32 z_value)
 
 static vertex2
 ProjectVertexNDC(const vertex3& v)
+{
+    vec4f clip = globalCamera.ViewToClip(v.point);
+    return {v.color, clip.x / clip.w, clip.y / clip.w};
+}
+
+// Pixels a view space length covers at depth, along the screen's height
+static f32
+ProjectedLength(f32 length, f32 depth)
 {
     f32 d = globalCamera.CameraOrigin().z + globalCamera.CameraFocalLength();
+    return (length * d / depth) * globalScreenDevice.height / globalCamera.CameraViewportHeight();
+}
 
-    f32 py = (v.point.y * d) / v.point.z;;
-    f32 px = (v.point.x * d) / v.point.z;;
+// Perspective divide and viewport transform, w is the view space depth
+static vec3f
+ProjectClipScreen(const vec4f& clip)
+{
+    f32 invW = 1 / clip.w;
 
-    // Projects from viewport to NDC
-    py = ((py * 2.0f) / globalCamera.CameraViewportHeight());
-    px = ((px * 2.0f) / globalCamera.CameraViewportWidth());
+    return
+    {
+        ((clip.x * invW + 1) / 2) * globalScreenDevice.width,
+        ((1 - clip.y * invW) / 2) * globalScreenDevice.height,
+        invW
+    };
+}
 
-    return {v.color, px, py};
+static vec2f
+ScreenToNDC(const vec3f& screen)
+{
+    return
+    {
+        (screen.x / globalScreenDevice.width) * 2 - 1,
+        1 - (screen.y / globalScreenDevice.height) * 2
+    };
+}
+
+static raster_target
+ScreenRasterTarget()
+{
+    return
+    {
+        (u32 *) globalScreenDevice.BufferMemory,
+        globalDepthBuffer,
+        globalNormalBuffer.data(),
+        globalHiZ.data(),
+        (globalScreenDevice.width + RASTER_HIZ_BLOCK - 1) >> RASTER_HIZ_BITS,
+        globalScreenDevice.width,
+        globalScreenDevice.height,
+        0, 0,
+        globalScreenDevice.width,
+        globalScreenDevice.height,
+        RASTER_DEPTH_TEST
+    };
 }
 
 static void
 BlackoutScreenBuffer(color4 color)
 {
-    u32 *tempBuffer = (u32 *) globalScreenDevice.BufferMemory;
-    std::fill(tempBuffer,
-            tempBuffer + (globalScreenDevice.width * globalScreenDevice.height),
-            color_uint32(color));
+    const u32 packedColor = color_uint32(color);
+    const raster_target screen = ScreenRasterTarget();
 
-    std::fill(globalDepthBuffer,
-            globalDepthBuffer + (globalScreenDevice.width * globalScreenDevice.height),
-            0.0f);
-            // used to be infinity until the 1/z shite
+    // Every tile clears its own rows, same split as the rasterizer
+    globalWorkers.ParallelFor(globalTiles.Count(), [&](i32 tile)
+    {
+        raster_target target = globalTiles.TileTarget(screen, tile);
+        for (i32 y = target.minY; y < target.maxY; ++y)
+        {
+            std::fill(target.colorBuffer + y * target.width + target.minX,
+                      target.colorBuffer + y * target.width + target.maxX,
+                      packedColor);
+
+            std::fill(target.depthBuffer + y * target.width + target.minX,
+                      target.depthBuffer + y * target.width + target.maxX,
+                      0.0f);
+                      // used to be infinity until the 1/z shite
+
+            if (globalShadingMode == SHADE_DEFERRED)
+            {
+                std::fill(target.normalBuffer + y * target.width + target.minX,
+                          target.normalBuffer + y * target.width + target.maxX,
+                          vec3f{0, 0, 0});
+            }
+        }
+    });
 }
 } // namspace screen_draw
 
@@ -130,12 +290,66 @@ BlackoutScreenBuffer(color4 color)
 namespace polygon_draw
 {
 
+// Liang-Barsky against the NDC square, false when nothing of the line is on screen. Triangles
+// are only clipped to the guard band so their edges can reach far off screen.
+static bool
+ClipLineNDC(vertex2& v0, vertex2& v1)
+{
+    const f32 dx = v1.point.x - v0.point.x;
+    const f32 dy = v1.point.y - v0.point.y;
+    const f32 p[4] = { -dx, dx, -dy, dy };
+    const f32 q[4] = { v0.point.x + 1, 1 - v0.point.x, v0.point.y + 1, 1 - v0.point.y };
+
+    f32 t0 = 0.0f;
+    f32 t1 = 1.0f;
+    for (i32 side = 0; side < 4; ++side)
+    {
+        if (p[side] == 0)
+        {
+            if (q[side] < 0) return false;
+            continue;
+        }
+
+        f32 t = q[side] / p[side];
+        if (p[side] < 0)
+        {
+            t0 = std::max(t0, t);
+        }
+        else
+        {
+            t1 = std::min(t1, t);
+        }
+    }
+    if (!(t0 <= t1))
+    {
+        return false;
+    }
+
+    vertex2 start = v0;
+    if (t0 > 0)
+    {
+        v0.point = start.point + (v1.point - start.point) * t0;
+        v0.color = linear_interpolate_color(t0, 0, start.color, 1, v1.color);
+    }
+    if (t1 < 1)
+    {
+        v1.point = start.point + (v1.point - start.point) * t1;
+        v1.color = linear_interpolate_color(t1, 0, start.color, 1, v1.color);
+    }
+    return true;
+}
+
 static void
 DrawLine(vertex2 v0, vertex2 v1, color4 line_color = NO_COLOR, int z_priority = -100)
 {
     color4 cmp = NO_COLOR;
     bool interpolate = line_color == cmp;
 
+    if (!ClipLineNDC(v0, v1))
+    {
+        return;
+    }
+
     // assumes the points are between -1 to 1
     f32 dy = 2.0f / globalScreenDevice.height;
     f32 dx = 2.0f / globalScreenDevice.width;
@@ -182,289 +396,382 @@ DrawNormal(const vertex3& v0)
 }
 
 static void
-DrawWireframeTriangle(vertex3 v0, vertex3 v1, vertex3 v2, color4 lineColor = NO_COLOR)
+DrawWireframeTriangle(const screen_vertex& v0, const screen_vertex& v1, const screen_vertex& v2, color4 lineColor = NO_COLOR)
 {
-    vertex2 p0 = screen_draw::ProjectVertexNDC(v0);
-    vertex2 p1 = screen_draw::ProjectVertexNDC(v1);
-    vertex2 p2 = screen_draw::ProjectVertexNDC(v2);
+    vec2f p0 = screen_draw::ScreenToNDC(v0.screen);
+    vec2f p1 = screen_draw::ScreenToNDC(v1.screen);
+    vec2f p2 = screen_draw::ScreenToNDC(v2.screen);
 
-    DrawLine({RED, p0.point}, {RED, p1.point}, lineColor, 1);
-    DrawLine({RED, p1.point}, {RED, p2.point}, lineColor, 1);
-    DrawLine({RED, p2.point}, {RED, p0.point}, lineColor, 1);
+    DrawLine({RED, p0}, {RED, p1}, lineColor, 1);
+    DrawLine({RED, p1}, {RED, p2}, lineColor, 1);
+    DrawLine({RED, p2}, {RED, p0}, lineColor, 1);
 }
 
-/*
-TODO: sort out the duplicated code int this function
-The hard gap problem was caused by a unifined scanline filling loop. Splitting it into
-top and bottom seems to have resolved the problem.
-
-What remains is a minor gap problem between the edges of tringaes.
-*/
-static void
-ShadeTrianglePhong(const vertex3& v0, const vertex3& v1, const vertex3& v2, const point_light& light, f32 ambientIntensity)
+// Pixel shaders ------------------------------------------------------------------------------
+struct constant_color_shader
 {
-     /*
-     // This is an old school scan line filling method
-                                        P2
+    static const i32 AttributeCount = 0;
+    static const bool IsWide = true;
+    static const bool WritesNormal = false;
+    u32 color;
 
+    u32 Shade(const f32 * /*attributes*/, f32 /*invZ*/) const { return color; }
+    simd_i32 ShadeWide(const simd_f32 * /*attributes*/, simd_f32 /*invZ*/) const { return simd_set1_i32(color); }
+};
 
-                                            P1
-
-                              P0
-    // TECNIQUE: Go from P0 to P2 and to P1 starting at Height = P0.y  but only up to Height = P1.y
-    // Then Go from P0 to P2 and from P1 to P2 starting at Height = P1.y ending at P2.y
-    */
-    const f32 dy = 2.0f / globalScreenDevice.height;
-    const f32 dx = 2.0f / globalScreenDevice.width;
-    const f32 d = globalCamera.CameraFocalLength();
-
-    vertex2 p0 = screen_draw::ProjectVertexNDC(v0);
-    vertex2 p1 = screen_draw::ProjectVertexNDC(v1);
-    vertex2 p2 = screen_draw::ProjectVertexNDC(v2);
-
-    f32 z0 = v0.point.z;
-    f32 z1 = v1.point.z;
-    f32 z2 = v2.point.z;
+struct gouraud_shader
+{
+    static const i32 AttributeCount = 3; // r, g, b
+    static const bool IsWide = true;
+    static const bool WritesNormal = false;
 
-    vec3f n0 = v0.normal;
-    vec3f n1 = v1.normal;
-    vec3f n2 = v2.normal;
+    u32 Shade(const f32 *attributes, f32 /*invZ*/) const
+    {
+        return color_uint32(attributes_color4(attributes, 0xFF));
+    }
 
-    // Sort the points in order y0 <= y1 <= y2
-    if (p1.point.y < p0.point.y)
+    simd_i32 ShadeWide(const simd_f32 *attributes, simd_f32 /*invZ*/) const
     {
-        std::swap(p0, p1);
-        std::swap(z0, z1);
-        std::swap(n0, n1);
+        return simd_pack_rgba(attributes[0], attributes[1], attributes[2], simd_set1_i32(0xFF));
     }
-    if (p2.point.y < p0.point.y)
+};
+
+// Lighting runs per pixel so this one only gets its coverage and depth test vectorized
+struct phong_shader
+{
+    static const i32 AttributeCount = 8; // r, g, b, normal x, y, z, x/z, y/z
+    static const bool IsWide = false;
+    static const bool WritesNormal = false;
+    point_light light;
+    vec3f cameraOrigin;
+    f32 ambientIntensity;
+    u8 alpha;
+
+    u32 Shade(const f32 *attributes, f32 invZ) const
     {
-        std::swap(p0, p2);
-        std::swap(z0, z2);
-        std::swap(n0, n2);
+        const f32 z = 1 / invZ;
+        vec3f normal = {attributes[3], attributes[4], attributes[5]};
+        return Light(attributes_color4(attributes, alpha), normalize(normal), {attributes[6] * z, attributes[7] * z, z});
     }
-    if (p2.point.y < p1.point.y)
+
+    // Also what the deferred lighting pass runs on the G-buffer
+    u32 Light(color4 baseColor, const vec3f& normal, const vec3f& point) const
     {
-        std::swap(p1, p2);
-        std::swap(z1, z2);
-        std::swap(n1, n2);
+        vertex3 p;
+        p.point = point;
+        p.normal = normal;
+
+        f32 intensity = (ambientIntensity + light.GetIntensityPhong(p, cameraOrigin - p.point));
+        baseColor *= intensity;
+        return color_uint32(baseColor);
     }
+};
 
-    bool interpolate02 = ((p0.color != p2.color));
-    bool interpolate01 = ((p0.color != p1.color));
-    bool interpolate12 = ((p1.color != p2.color));
+// Leaves what phong_shader needs besides the position in the G-buffer, the depth gives that back
+struct gbuffer_shader
+{
+    static const i32 AttributeCount = 6; // r, g, b, normal x, y, z
+    static const bool IsWide = false;
+    static const bool WritesNormal = true;
+    u8 alpha;
 
-    for (f32 y = p0.point.y; y < p1.point.y; y+=dy)
+    u32 Shade(const f32 *attributes, f32 /*invZ*/) const
     {
-        f32 startX = linear_interpolate(y, p0.point.y, p0.point.x, p2.point.y, p2.point.x);
-        f32 endX = linear_interpolate(y, p0.point.y, p0.point.x, p1.point.y, p1.point.x);
+        return color_uint32(attributes_color4(attributes, alpha));
+    }
 
-        f32 startZ = linear_interpolate(y, p0.point.y, 1/z0, p2.point.y, 1/z2);
-        f32 endZ = linear_interpolate(y, p0.point.y, 1/z0, p1.point.y, 1/z1);
+    vec3f Normal(const f32 *attributes) const
+    {
+        vec3f normal = {attributes[3], attributes[4], attributes[5]};
+        return normalize(normal);
+    }
+};
 
-        // Normal Interpolation ------------------------------------------------------------------------
-        // TODO: make a vec_interpolate function
-        f32 startNormalX = linear_interpolate(y, p0.point.y, n0.x, p2.point.y, n2.x);
-        f32 endNormalX = linear_interpolate(y, p0.point.y, n0.x, p1.point.y, n1.x);
-        f32 startNormalY = linear_interpolate(y, p0.point.y, n0.y, p2.point.y, n2.y);
-        f32 endNormalY = linear_interpolate(y, p0.point.y, n0.y, p1.point.y, n1.y);
-        f32 startNormalZ = linear_interpolate(y, p0.point.y, n0.z, p2.point.y, n2.z);
-        f32 endNormalZ = linear_interpolate(y, p0.point.y, n0.z, p1.point.y, n1.z);
+// Tile binning -------------------------------------------------------------------------------
+// Shaded triangles are only recorded and binned while the objects are drawn, the tiles are
+// rasterized in parallel at the end of the frame.
+enum binned_shader
+{
+    BINNED_CONSTANT,
+    BINNED_GOURAUD,
+    BINNED_PHONG,
+    BINNED_GBUFFER
+};
 
-        // Color Interpolation -------------------------------------------------------------------------
-        color4 startColor = interpolate02 ? linear_interpolate_color(y , p0.point.y, p0.color, p2.point.y, p2.color) : p0.color;
-        color4 endColor = interpolate01 ? linear_interpolate_color(y, p0.point.y, p0.color, p1.point.y, p1.color) : p1.color;
+/*
+140 bytes
+*/
+struct binned_triangle
+{
+    raster_vertex v[3];
+    binned_shader shader;
+    u32 color;  // Packed color for BINNED_CONSTANT, alpha for BINNED_PHONG and BINNED_GBUFFER
+};
 
-        if (startX > endX)
-        {
-            std::swap(startX, endX);
-            std::swap(startZ, endZ);
-            std::swap(startNormalX, endNormalX);
-            std::swap(startNormalY, endNormalY);
-            std::swap(startNormalZ, endNormalZ);
-            std::swap(startColor, endColor);
-        }
+static std::vector<binned_triangle> globalBinnedTriangles;
+static std::vector<raster_counts> globalTileCounts;    // Pixels tested and written by each tile this frame.
+static phong_shader globalBinnedPhong;  // Lighting used by this frame's BINNED_PHONG triangles
 
-        for (f32 x = startX; x <= endX; x+=dx)
-        {
-            color4 col = (interpolate02 || interpolate01) ? linear_interpolate_color(x, startX, startColor, endX, endColor) : startColor;
-            const f32 z = linear_interpolate(x, startX, 1/startZ, endX, 1/endZ);
+static void
+BinTriangle(const raster_vertex& v0, const raster_vertex& v1, const raster_vertex& v2, binned_shader shader, u32 color)
+{
+    u32 index = static_cast<u32>(globalBinnedTriangles.size());
+    globalBinnedTriangles.push_back({{v0, v1, v2}, shader, color});
+
+    globalTiles.Bin(index,
+                    std::min(v0.screen.x, std::min(v1.screen.x, v2.screen.x)),
+                    std::min(v0.screen.y, std::min(v1.screen.y, v2.screen.y)),
+                    std::max(v0.screen.x, std::max(v1.screen.x, v2.screen.x)),
+                    std::max(v0.screen.y, std::max(v1.screen.y, v2.screen.y)));
+}
 
-            const f32 normal_x = linear_interpolate(x, startX, startNormalX, endX, endNormalX);
-            const f32 normal_y = linear_interpolate(x, startX, startNormalY, endX, endNormalY);
-            const f32 normal_z = linear_interpolate(x, startX, startNormalZ, endX, endNormalZ);
+static raster_counts
+RasterizeTile(const raster_target& screen, i32 tile, bool depthPrepass)
+{
+    raster_target target = globalTiles.TileTarget(screen, tile);
+    phong_shader phong = globalBinnedPhong;
+    raster_counts counts = {};
 
-            vertex3 p;
-            p.point.x = x*d/z;
-            p.point.y = y*d/z;
-            p.point.z = z;
-            p.normal = {normal_x, normal_y, normal_z};
-            p.normal = normalize(p.normal);
+    // Same depth and normals, base colors instead of the screen
+    raster_target gbuffer = target;
+    gbuffer.colorBuffer = globalBaseColorBuffer.data();
 
-            f32 intensity = (ambientIntensity +  light.GetIntensityPhong(p, globalCamera.CameraOrigin() - p.point));
-            col *= intensity;
+    // Lines and normals were drawn straight into the depth buffer, start from what is there
+    if (!globalTiles.bins[tile].empty())
+    {
+        RefreshHiZ(target);
+    }
 
-            screen_draw::PutPixelNDC({col, x, y}, 1/z);
+    // Settle the depth of the whole tile first, the shaders then only run where their triangle won
+    if (depthPrepass)
+    {
+        target.depthMode = RASTER_DEPTH_ONLY;
+        for (u32 index : globalTiles.bins[tile])
+        {
+            const binned_triangle& t = globalBinnedTriangles[index];
+            raster_counts triangle = RasterizeTriangle(target, t.v[0], t.v[1], t.v[2], constant_color_shader());
+            counts.tested += triangle.tested;
+            counts.hidden += triangle.hidden;
+            counts.hiddenBlocks += triangle.hiddenBlocks;
         }
+        target.depthMode = RASTER_DEPTH_EQUAL;
     }
 
-    for (f32 y = p1.point.y; y <= p2.point.y; y+=dy)
+    for (u32 index : globalTiles.bins[tile])
     {
-        f32 startX = linear_interpolate(y, p0.point.y, p0.point.x, p2.point.y, p2.point.x);
-        f32 endX = linear_interpolate(y, p1.point.y, p1.point.x, p2.point.y, p2.point.x);
+        const binned_triangle& t = globalBinnedTriangles[index];
+        raster_counts triangle = {};
+        switch (t.shader)
+        {
+            case BINNED_CONSTANT:
+            {
+                constant_color_shader shader = { t.color };
+                triangle = RasterizeTriangle(target, t.v[0], t.v[1], t.v[2], shader);
+            } break;
+
+            case BINNED_GOURAUD:
+            {
+                triangle = RasterizeTriangle(target, t.v[0], t.v[1], t.v[2], gouraud_shader());
+            } break;
+
+            case BINNED_PHONG:
+            {
+                phong.alpha = static_cast<u8>(t.color);
+                triangle = RasterizeTriangle(target, t.v[0], t.v[1], t.v[2], phong);
+            } break;
+
+            case BINNED_GBUFFER:
+            {
+                gbuffer_shader shader = { static_cast<u8>(t.color) };
+                triangle = RasterizeTriangle(gbuffer, t.v[0], t.v[1], t.v[2], shader);
+            } break;
+        }
+        counts.tested += triangle.tested;
+        counts.written += triangle.written;
+        counts.hidden += triangle.hidden;
+        counts.hiddenBlocks += triangle.hiddenBlocks;
+    }
+    return counts;
+}
 
-        f32 startZ = linear_interpolate(y, p0.point.y, 1/z0, p2.point.y, 1/z2);
-        f32 endZ = linear_interpolate(y, p1.point.y, 1/z1, p2.point.y, 1/z2);
+// Each tile only touches its own part of the color and depth buffers so no locking is needed
+static void
+RasterizeBinnedTriangles()
+{
+    const raster_target screen = screen_draw::ScreenRasterTarget();
+    const bool depthPrepass = globalShadingMode == SHADE_PHONG_PREPASS;
+    globalTileCounts.assign(globalTiles.Count(), raster_counts());
+    globalWorkers.ParallelFor(globalTiles.Count(), [&](i32 tile)
+    {
+        globalTileCounts[tile] = RasterizeTile(screen, tile, depthPrepass);
+    });
 
-        // Normal Interpolation ------------------------------------------------------------------------
-        f32 startNormalX = linear_interpolate(y, p0.point.y, n0.x, p2.point.y, n2.x);
-        f32 endNormalX = linear_interpolate(y, p1.point.y, n1.x, p2.point.y, n2.x);
-        f32 startNormalY = linear_interpolate(y, p0.point.y, n0.y, p2.point.y, n2.y);
-        f32 endNormalY = linear_interpolate(y, p1.point.y, n1.y, p2.point.y, n2.y);
-        f32 startNormalZ = linear_interpolate(y, p0.point.y, n0.z, p2.point.y, n2.z);
-        f32 endNormalZ = linear_interpolate(y, p1.point.y, n1.z, p2.point.y, n2.z);
+    PERF_COUNT(globalPerf, PERF_TRIANGLES_BINNED, globalBinnedTriangles.size());
+    globalFrameStats.pixelsWritten = 0;
+    for (const raster_counts& counts : globalTileCounts)
+    {
+        globalFrameStats.pixelsWritten += counts.written;
+        PERF_COUNT(globalPerf, PERF_PIXELS_TESTED, counts.tested);
+        PERF_COUNT(globalPerf, PERF_PIXELS_WRITTEN, counts.written);
+        PERF_COUNT(globalPerf, PERF_HIZ_TRIANGLES_HIDDEN, counts.hidden);
+        PERF_COUNT(globalPerf, PERF_HIZ_BLOCKS_HIDDEN, counts.hiddenBlocks);
+    }
 
-        // Color Interpolation -------------------------------------------------------------------------
-        color4 startColor = interpolate02 ? linear_interpolate_color(y , p0.point.y, p0.color, p2.point.y, p2.color) : p0.color;
-        color4 endColor = interpolate12 ? linear_interpolate_color(y, p1.point.y, p1.color, p2.point.y, p2.color) : p1.color;
+    globalTiles.ClearBins();
+    globalBinnedTriangles.clear();
+}
+
+// Deferred lighting ---------------------------------------------------------------------------
+// SHADE_DEFERRED rasterizes base colors and normals into a G-buffer and lights it in a separate
+// pass over the screen, so frames where only the light moved can skip straight to that pass.
 
-        if (startX > endX)
+// Lights every pixel a triangle left a normal in, the same way phong_shader would have
+static void
+LightGBuffer(const point_light& light, f32 ambientIntensity)
+{
+    const raster_target screen = screen_draw::ScreenRasterTarget();
+    const phong_shader phong = { light, globalCamera.CameraOrigin(), ambientIntensity, 0xFF };
+
+    // Pixel centers back to x/z and y/z, undoing the viewport transform and the projection's scale
+    const mat4x4& projection = globalCamera.CameraProjection();
+    const f32 xStep = 2.0f / (screen.width * projection.m[0][0]);
+    const f32 yStep = -2.0f / (screen.height * projection.m[1][1]);
+    const f32 xFirst = 0.5f * xStep - 1.0f / projection.m[0][0];
+    const f32 yFirst = 0.5f * yStep + 1.0f / projection.m[1][1];
+
+#ifdef PERF_ON
+    std::vector<i32> tileLit(globalTiles.Count(), 0);
+#endif
+    globalWorkers.ParallelFor(globalTiles.Count(), [&](i32 tile)
+    {
+        const raster_target target = globalTiles.TileTarget(screen, tile);
+        PERF_ONLY(i32 lit = 0);
+        for (i32 y = target.minY; y < target.maxY; ++y)
         {
-            std::swap(startX, endX);
-            std::swap(startZ, endZ);
-            std::swap(startNormalX, endNormalX);
-            std::swap(startNormalY, endNormalY);
-            std::swap(startNormalZ, endNormalZ);
-            std::swap(startColor, endColor);
+            const f32 yOverZ = yFirst + yStep * y;
+            for (i32 x = target.minX; x < target.maxX; ++x)
+            {
+                const i32 pixel = y * target.width + x;
+                const vec3f& normal = target.normalBuffer[pixel];
+                if (normal.x == 0 && normal.y == 0 && normal.z == 0)
+                {
+                    continue;
+                }
+
+                const f32 z = 1 / target.depthBuffer[pixel];
+                const vec3f point = {(xFirst + xStep * x) * z, yOverZ * z, z};
+                target.colorBuffer[pixel] = phong.Light(uint32_color4(globalBaseColorBuffer[pixel]), normal, point);
+                PERF_ONLY(++lit);
+            }
         }
+        PERF_ONLY(tileLit[tile] = lit);
+    });
 
-        for (f32 x = startX; x <= endX; x+=dx)
-        {
-            color4 col = (interpolate02 || interpolate12) ? linear_interpolate_color(x, startX, startColor, endX, endColor) : startColor;
-            const f32 z = linear_interpolate(x, startX, 1/startZ, endX, 1/endZ);
+#ifdef PERF_ON
+    for (i32 lit : tileLit)
+    {
+        PERF_COUNT(globalPerf, PERF_PIXELS_LIT, lit);
+    }
+#endif
+}
 
-            const f32 normal_x = linear_interpolate(x, startX, startNormalX, endX, endNormalX);
-            const f32 normal_y = linear_interpolate(x, startX, startNormalY, endX, endNormalY);
-            const f32 normal_z = linear_interpolate(x, startX, startNormalZ, endX, endNormalZ);
+static raster_vertex
+RasterVertex(const screen_vertex& v)
+{
+    raster_vertex result = {};
+    result.screen = {v.screen.x, v.screen.y};
+    result.invZ = v.screen.z;
+    return result;
+}
 
-            vertex3 p;
-            p.point.x = x*d/z;
-            p.point.y = y*d/z;
-            p.point.z = z;
-            p.normal = {normal_x, normal_y, normal_z};
-            p.normal = normalize(p.normal);
-            f32 intensity = (ambientIntensity +  light.GetIntensityPhong(p, globalCamera.CameraOrigin() - p.point));
-            col *= intensity;
+static void
+SetColorAttributes(raster_vertex& v, color4 color)
+{
+    v.attributes[0] = color.r;
+    v.attributes[1] = color.g;
+    v.attributes[2] = color.b;
+}
 
-           screen_draw::PutPixelNDC({col, x, y}, 1/z);
-        }
+static void
+ShadeTrianglePhong(const screen_vertex& s0, const screen_vertex& s1, const screen_vertex& s2, const point_light& light, f32 ambientIntensity)
+{
+    const screen_vertex *vertices[3] = { &s0, &s1, &s2 };
+    raster_vertex p[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const vertex3& v = vertices[i]->view;
+        p[i] = RasterVertex(*vertices[i]);
+        SetColorAttributes(p[i], v.color);
+        p[i].attributes[3] = v.normal.x;
+        p[i].attributes[4] = v.normal.y;
+        p[i].attributes[5] = v.normal.z;
+        p[i].attributes[6] = v.point.x / v.point.z;
+        p[i].attributes[7] = v.point.y / v.point.z;
     }
+
+    globalBinnedPhong = { light, globalCamera.CameraOrigin(), ambientIntensity, 0xFF };
+    BinTriangle(p[0], p[1], p[2], BINNED_PHONG, s0.view.color.a);
 }
 
 static void
-ShadeTriangleGouraudFlat(const vertex3& v0, const vertex3& v1, const vertex3& v2, const point_light& light, f32 ambientIntensity, ShadingOption mode = SHADE_FLAT)
+ShadeTriangleDeferred(const screen_vertex& s0, const screen_vertex& s1, const screen_vertex& s2)
 {
-    const f32 dy = 2.0f / globalScreenDevice.height;
-    const f32 dx = 2.0f / globalScreenDevice.width;
+    const screen_vertex *vertices[3] = { &s0, &s1, &s2 };
+    raster_vertex p[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const vertex3& v = vertices[i]->view;
+        p[i] = RasterVertex(*vertices[i]);
+        SetColorAttributes(p[i], v.color);
+        p[i].attributes[3] = v.normal.x;
+        p[i].attributes[4] = v.normal.y;
+        p[i].attributes[5] = v.normal.z;
+    }
 
-    vertex2 p0 = screen_draw::ProjectVertexNDC(v0);
-    vertex2 p1 = screen_draw::ProjectVertexNDC(v1);
-    vertex2 p2 = screen_draw::ProjectVertexNDC(v2);
+    BinTriangle(p[0], p[1], p[2], BINNED_GBUFFER, s0.view.color.a);
+}
 
-    f32 z0 = v0.point.z;
-    f32 z1 = v1.point.z;
-    f32 z2 = v2.point.z;
+static void
+ShadeTriangleGouraudFlat(const screen_vertex& s0, const screen_vertex& s1, const screen_vertex& s2, const point_light& light, f32 ambientIntensity, ShadingOption mode = SHADE_FLAT)
+{
+    const vertex3& v0 = s0.view;
+    const vertex3& v1 = s1.view;
+    const vertex3& v2 = s2.view;
 
+    color4 c0, c1, c2;
     if (mode == SHADE_FLAT)
     {
         f32 intensity = light.GetIntensityFlat(cross(v1.point - v0.point, v2.point - v0.point), average(v0.point, v1.point, v2.point));
-        p0.color = p0.color * (ambientIntensity + intensity);
-        p1.color = p1.color * (ambientIntensity + intensity);
-        p2.color = p2.color * (ambientIntensity + intensity);
+        c0 = v0.color * (ambientIntensity + intensity);
+        c1 = v1.color * (ambientIntensity + intensity);
+        c2 = v2.color * (ambientIntensity + intensity);
     }
     else
     {
-        p0.color = p0.color * (ambientIntensity + light.GetIntensityGouraud(v0));
-        p1.color = p1.color * (ambientIntensity + light.GetIntensityGouraud(v1));
-        p2.color = p2.color * (ambientIntensity + light.GetIntensityGouraud(v2));
+        c0 = v0.color * (ambientIntensity + light.GetIntensityGouraud(v0));
+        c1 = v1.color * (ambientIntensity + light.GetIntensityGouraud(v1));
+        c2 = v2.color * (ambientIntensity + light.GetIntensityGouraud(v2));
     }
 
+    raster_vertex p0 = RasterVertex(s0);
+    raster_vertex p1 = RasterVertex(s1);
+    raster_vertex p2 = RasterVertex(s2);
 
-    if (p1.point.y < p0.point.y)
+    // Nothing to interpolate
+    if (c0 == c1 && c0 == c2)
     {
-        std::swap(p0, p1);
-        std::swap(z0, z1);
-    }
-    if (p2.point.y < p0.point.y)
-    {
-        std::swap(p0, p2);
-        std::swap(z0, z2);
-    }
-    if (p2.point.y < p1.point.y)
-    {
-        std::swap(p1, p2);
-        std::swap(z1, z2);
-    }
-
-    bool interpolate02 = ((p0.color != p2.color));
-    bool interpolate01 = ((p0.color != p1.color));
-    bool interpolate12 = ((p1.color != p2.color));
-
-    for (f32 y = p0.point.y; y < p1.point.y; y+=dy)
-    {
-        f32 startX = linear_interpolate(y, p0.point.y, p0.point.x, p2.point.y, p2.point.x);
-        f32 endX = linear_interpolate(y, p0.point.y, p0.point.x, p1.point.y, p1.point.x);
-
-        f32 startZ = linear_interpolate(y, p0.point.y, 1/z0, p2.point.y, 1/z2);
-        f32 endZ = linear_interpolate(y, p0.point.y, 1/z0, p1.point.y, 1/z1);
-
-        color4 startColor = interpolate02 ? linear_interpolate_color(y , p0.point.y, p0.color, p2.point.y, p2.color) : p0.color;
-        color4 endColor = interpolate01 ? linear_interpolate_color(y, p0.point.y, p0.color, p1.point.y, p1.color) : p1.color;
-
-        if (startX > endX)
-        {
-            std::swap(startX, endX);
-            std::swap(startZ, endZ);
-            std::swap(startColor, endColor);
-        }
-
-        for (f32 x = startX; x <= endX; x+=dx)
-        {
-            color4 col = (interpolate02 || interpolate01) ? linear_interpolate_color(x, startX, startColor, endX, endColor) : startColor;
-            const f32 z = linear_interpolate(x, startX, 1/startZ, endX, 1/endZ);
-            screen_draw::PutPixelNDC({col, x, y}, 1/z);
-        }
+        BinTriangle(p0, p1, p2, BINNED_CONSTANT, color_uint32(c0));
+        return;
     }
 
-    for (f32 y = p1.point.y; y <= p2.point.y; y+=dy)
-    {
-        f32 startX = linear_interpolate(y, p0.point.y, p0.point.x, p2.point.y, p2.point.x);
-        f32 endX = linear_interpolate(y, p1.point.y, p1.point.x, p2.point.y, p2.point.x);
-
-        f32 startZ = linear_interpolate(y, p0.point.y, 1/z0, p2.point.y, 1/z2);
-        f32 endZ = linear_interpolate(y, p1.point.y, 1/z1, p2.point.y, 1/z2);
-
-        color4 startColor = interpolate02 ? linear_interpolate_color(y , p0.point.y, p0.color, p2.point.y, p2.color) : p0.color;
-        color4 endColor = interpolate12 ? linear_interpolate_color(y, p1.point.y, p1.color, p2.point.y, p2.color) : p1.color;
-
-        if (startX > endX)
-        {
-            std::swap(startX, endX);
-            std::swap(startZ, endZ);
-            std::swap(startColor, endColor);
-        }
-
-        for (f32 x = startX; x <= endX; x+=dx)
-        {
-            color4 col = (interpolate02 || interpolate12) ? linear_interpolate_color(x, startX, startColor, endX, endColor) : startColor;
-            const f32 z = linear_interpolate(x, startX, 1/startZ, endX, 1/endZ);
-            screen_draw::PutPixelNDC({col, x, y}, 1/z);
-        }
-    }
+    SetColorAttributes(p0, c0);
+    SetColorAttributes(p1, c1);
+    SetColorAttributes(p2, c2);
+    BinTriangle(p0, p1, p2, BINNED_GOURAUD, 0);
 }
 
 static void
-ShadeTriangleInMode(const vertex3& v0, const vertex3& v1, const vertex3& v2, const point_light& light, f32 ambientIntensity, ShadingOption option)
+ShadeTriangleInMode(const screen_vertex& v0, const screen_vertex& v1, const screen_vertex& v2, const point_light& light, f32 ambientIntensity, ShadingOption option)
 {
     switch (option)
     {
@@ -474,6 +781,7 @@ ShadeTriangleInMode(const vertex3& v0, const vertex3& v1, const vertex3& v2, con
         } break;
 
         case SHADE_PHONG:
+        case SHADE_PHONG_PREPASS:
         {
             ShadeTrianglePhong(v0, v1, v2, light, ambientIntensity);
         } break;
@@ -482,6 +790,11 @@ ShadeTriangleInMode(const vertex3& v0, const vertex3& v1, const vertex3& v2, con
         {
             ShadeTriangleGouraudFlat(v0, v1, v2, light, ambientIntensity, SHADE_GOURAUD);
         } break;
+
+        case SHADE_DEFERRED:
+        {
+            ShadeTriangleDeferred(v0, v1, v2);
+        } break;
     }
 }
 } // namespace polygon_draw
@@ -498,177 +811,556 @@ IsBackface(const vec3f& v0, const vec3f& v1, const vec3f& v2)
     return dot(vToCam, normal) <= 0;
 }
 
-static ClippedTriangle
-ProcessTriangle(i32 index, Object3D *O, const mat4x4& transform, const mat4x4& rot, bool cullBackfaces = true)
+static inline void
+CacheVertex(vertex_cache& cache, u32 i, const vec3f& v, const vec3f& normal)
+{
+    cache.positions[i] = v;
+    cache.normals[i] = normal;
+
+    vec4f clip = globalCamera.ViewToClip(v);
+    u32 outcode = ClipOutcode(clip, globalGuardBand);
+    cache.outcodes[i] = static_cast<u16>(outcode);
+    if (GuardBandClipPlanes(outcode) == 0)
+    {
+        cache.screen[i] = screen_draw::ProjectClipScreen(clip);
+    }
+}
+
+// Readies the cache and the matrices for drawing O, its vertices are processed meshlet by meshlet
+static void
+BeginObjectVertices(Object3D *O)
+{
+    const Model3D *M = O->ObjectModel;
+    vertex_cache& cache = globalVertexCache;
+    cache.positions.resize(M->vn);
+    cache.normals.resize(M->vn);
+    cache.screen.resize(M->vn);
+    cache.outcodes.resize(M->vn);
+    cache.drawn.resize(M->vn, 0);
+    if (++cache.draw == 0)
+    {
+        std::fill(cache.drawn.begin(), cache.drawn.end(), 0);
+        cache.draw = 1;
+    }
+
+    globalCamera.UpdateObjectMatrices(O);
+
+    // Packed model, the position dequantization rides along with the model-view transform
+    if (M->Vertices == nullptr)
+    {
+        cache.packedView = UnpackPositionMatrix(M->BoundingSphere) * O->modelView;
+    }
+}
+
+// Transforms and projects the vertices of a meshlet that no earlier meshlet of this draw already did
+template <typename Index>
+static void
+ProcessMeshletVertices(Object3D *O, const Index *indices, u32 indexCount)
 {
-    int i0 = O->ObjectModel->vertexIndices[index * 3];
-    int i1 = O->ObjectModel->vertexIndices[index * 3 + 1];
-    int i2 = O->ObjectModel->vertexIndices[index * 3 + 2];
+    const Model3D *M = O->ObjectModel;
+    vertex_cache& cache = globalVertexCache;
+    const mat4x4& modelView = O->modelView;
+    const mat3x3& normalMatrix = O->normalMatrix;
 
-    int in0 = O->ObjectModel->normalIndices[index * 3];
-    int in1 = O->ObjectModel->normalIndices[index * 3 + 1];
-    int in2 = O->ObjectModel->normalIndices[index * 3 + 2];
+    for (u32 i = 0; i < indexCount; ++i)
+    {
+        u32 v = indices[i];
+        if (cache.drawn[v] == cache.draw)
+        {
+            continue;
+        }
+        cache.drawn[v] = cache.draw;
+        PERF_COUNT(globalPerf, PERF_VERTICES, 1);
 
-    // NOTE: maybe we should fuse position normal and color in Object3D to just have 1 vertex3
-    vec3f v0 = O->ObjectModel->VertexPositions[i0];
-    vec3f v1 = O->ObjectModel->VertexPositions[i1];
-    vec3f v2 = O->ObjectModel->VertexPositions[i2];
+        if (M->Vertices != nullptr)
+        {
+            // Straight into camera space
+            const vertex3& vertex = M->Vertices[v];
+            CacheVertex(cache, v, vertex.point * modelView, vertex.normal * normalMatrix);
+        }
+        else
+        {
+            const packed_vertex& vertex = M->PackedVertices[v];
+            CacheVertex(cache, v, PackedPositionVector(vertex) * cache.packedView, UnpackNormal(vertex.normal) * normalMatrix);
+        }
+    }
+}
 
-    color4 c0 = O->ObjectModel->VertexColors[i0];
-    color4 c1 = O->ObjectModel->VertexColors[i1];
-    color4 c2 = O->ObjectModel->VertexColors[i2];
+// Rejects meshlets outside the frustum, and with cullBackfaces ones whose every triangle faces away
+static bool
+MeshletVisible(const Object3D *O, const model_meshlet& meshlet, bool cullBackfaces)
+{
+    PERF_COUNT(globalPerf, PERF_MESHLETS_IN, 1);
+    sphere viewSphere = {meshlet.bounds.center * O->modelView, meshlet.bounds.radius * O->scale};
+    if (!globalCamera.ViewSphereInFrustum(viewSphere))
+    {
+        PERF_COUNT(globalPerf, PERF_MESHLETS_OUTSIDE, 1);
+        return false;
+    }
 
-    vec3f n0 = O->ObjectModel->vertexNormals[in0];
-    vec3f n1 = O->ObjectModel->vertexNormals[in1];
-    vec3f n2 = O->ObjectModel->vertexNormals[in2];
+    // The camera sees the back of every triangle when it looks down the cone from far enough
+    // inside it, the sphere radius keeps that true for the whole meshlet
+    if (cullBackfaces)
+    {
+        vec3f axis = meshlet.coneAxis * O->normalMatrix;
+        vec3f toCenter = viewSphere.center - globalCamera.CameraOrigin();
+        if (dot(toCenter, axis) >= meshlet.coneCutoff * length(toCenter) + viewSphere.radius)
+        {
+            PERF_COUNT(globalPerf, PERF_MESHLETS_BACKFACE, 1);
+            return false;
+        }
+    }
+    return true;
+}
 
-    // Project into world and camera space
-    v0 = v0 * transform;
-    v1 = v1 * transform;
-    v2 = v2 * transform;
+static screen_vertex
+CachedVertex(const Model3D *M, i32 index)
+{
+    return
+    {
+        { globalVertexCache.positions[index], globalVertexCache.normals[index], ModelVertexColor(M, index) },
+        globalVertexCache.screen[index]
+    };
+}
 
-    n0 = n0 * rot;
-    n1 = n1 * rot;
-    n2 = n2 * rot;
+static clip_vertex
+CachedClipVertex(const Model3D *M, i32 index)
+{
+    const vec3f& position = globalVertexCache.positions[index];
+    return { { position, globalVertexCache.normals[index], ModelVertexColor(M, index) }, globalCamera.ViewToClip(position) };
+}
 
-    // TODO(Reuel): All of this should be done camera side GlobalCamera.Project or something like this
-    v0 = v0 * globalCamera.CameraViewMatrix();
-    v1 = v1 * globalCamera.CameraViewMatrix();
-    v2 = v2 * globalCamera.CameraViewMatrix();
+template <typename Index>
+static assembled_triangles
+ProcessTriangle(const Index *indices, i32 index, const Model3D *M, bool cullBackfaces = true)
+{
+    int i0 = indices[index * 3];
+    int i1 = indices[index * 3 + 1];
+    int i2 = indices[index * 3 + 2];
 
-    n0 = n0 * globalCamera.CameraRotation();
-    n1 = n1 * globalCamera.CameraRotation();
-    n2 = n2 * globalCamera.CameraRotation();
+    const vertex_cache& cache = globalVertexCache;
 
-    ClippedTriangle result = {};
+    assembled_triangles result = {};
     result.IsIn = false;
+    PERF_COUNT(globalPerf, PERF_TRIANGLES_IN, 1);
     // Cull Backfaces
-    if (IsBackface(v0, v1, v2) && cullBackfaces) return result;
-    return ClipTriangle({v0, n0, c0}, {v1, n1, c1}, {v2, n2, c2}, globalCamera.CameraFrustum());
+    if (cullBackfaces && IsBackface(cache.positions[i0], cache.positions[i1], cache.positions[i2]))
+    {
+        PERF_COUNT(globalPerf, PERF_TRIANGLES_BACKFACE, 1);
+        return result;
+    }
+
+    // Every vertex is outside the same plane
+    u32 outcode0 = cache.outcodes[i0];
+    u32 outcode1 = cache.outcodes[i1];
+    u32 outcode2 = cache.outcodes[i2];
+    if ((outcode0 & outcode1 & outcode2 & CLIP_FRUSTUM_BITS) != 0)
+    {
+        PERF_COUNT(globalPerf, PERF_TRIANGLES_OUTSIDE, 1);
+        return result;
+    }
+
+    // Nothing to clip, the projections are already in the cache
+    u32 planes = GuardBandClipPlanes(outcode0 | outcode1 | outcode2);
+    if (planes == 0)
+    {
+        PERF_COUNT(globalPerf, PERF_TRIANGLES_GUARD_BAND, ((outcode0 | outcode1 | outcode2) & CLIP_FRUSTUM_BITS) ? 1 : 0);
+        result.IsIn = true;
+        result.count = 3;
+        result.v[0] = CachedVertex(M, i0);
+        result.v[1] = CachedVertex(M, i1);
+        result.v[2] = CachedVertex(M, i2);
+        return result;
+    }
+
+    ClippedPolygon clipped = ClipTriangle(CachedClipVertex(M, i0),
+                                          CachedClipVertex(M, i1),
+                                          CachedClipVertex(M, i2),
+                                          planes);
+    if (clipped.count < 3)
+    {
+        PERF_COUNT(globalPerf, PERF_TRIANGLES_OUTSIDE, 1);
+        return result;
+    }
+    PERF_COUNT(globalPerf, PERF_TRIANGLES_CLIPPED, 1);
+    PERF_COUNT(globalPerf, PERF_TRIANGLES_SPLIT, clipped.count > 3 ? 1 : 0);
+
+    result.IsIn = true;
+    result.count = clipped.count;
+    for (u32 i = 0; i < clipped.count; ++i)
+    {
+        result.v[i] = { clipped.v[i].view, screen_draw::ProjectClipScreen(clipped.v[i].clip) };
+    }
+    return result;
 }
 
+// Runs draw on every triangle of the meshlets of lod that MeshletVisible keeps. Rejected meshlets
+// never get their vertices processed.
+template <typename Index, typename TriangleFunction>
 static void
-DrawObjectSolid(Object3D *O)
+ForEachVisibleTriangle(Object3D *O, const Index *indices, const model_lod& lod, bool cullBackfaces, TriangleFunction draw)
+{
+    const Model3D *M = O->ObjectModel;
+    BeginObjectVertices(O);
+    for (u32 m = lod.firstMeshlet; m < lod.firstMeshlet + lod.meshletCount; ++m)
+    {
+        const model_meshlet& meshlet = M->Meshlets[m];
+        if (!MeshletVisible(O, meshlet, cullBackfaces)) continue;
+
+        const Index *meshletIndices = indices + meshlet.firstIndex;
+        ProcessMeshletVertices(O, meshletIndices, meshlet.triangleCount * 3);
+        for (u32 i = 0; i < meshlet.triangleCount; ++i)
+        {
+            draw(ProcessTriangle(meshletIndices, i, M, cullBackfaces));
+        }
+    }
+}
+
+template <typename Index>
+static void
+DrawObjectSolid(Object3D *O, const Index *indices, const model_lod& lod)
 {
     assert(O != nullptr);
 
-    // Preliminary culling based on bounding volume (sphere here)
-    if (!globalCamera.ObjectInFrustum(O))
+    ForEachVisibleTriangle(O, indices, lod, true, [&](const assembled_triangles& triangles)
     {
-        return;
-    }
+        if (!triangles.IsIn) return;
+        globalFrameStats.trianglesDrawn += triangles.count - 2;
 
-    mat4x4 transform = O->ObjectTransform();
-    mat4x4 rot = O->ObjectRotation();
-    for (int i = 0; i < O->ObjectModel->in / 3; ++i)
+        if (globalRenderNormals) 
+        {
+            polygon_draw::DrawNormal(triangles.v[0].view);
+            polygon_draw::DrawNormal(triangles.v[1].view);
+            polygon_draw::DrawNormal(triangles.v[2].view);
+        }
+        for (u32 i = 1; i + 1 < triangles.count; ++i)
+        {
+            polygon_draw::ShadeTriangleInMode(triangles.v[0], triangles.v[i], triangles.v[i + 1], globalOmniLight, globalAmbientLight.intensity, globalShadingMode);
+        }
+    });
+}
+
+template <typename Index>
+static void
+DrawObjectWireframe(Object3D *O, const Index *indices, const model_lod& lod)
+{
+    assert(O != nullptr);
+
+    // Backfaces stay, only faces outside the frustum are culled
+    ForEachVisibleTriangle(O, indices, lod, false, [&](const assembled_triangles& triangles)
     {
-        ClippedTriangle triangles = ProcessTriangle(i, O, transform, rot);
+        if (!triangles.IsIn) return;
+        globalFrameStats.trianglesDrawn += triangles.count - 2;
+        
+        if (globalRenderNormals) 
+        {
+            polygon_draw::DrawNormal(triangles.v[0].view);
+            polygon_draw::DrawNormal(triangles.v[1].view);
+            polygon_draw::DrawNormal(triangles.v[2].view);
+        }
 
-        if (!triangles.IsIn) continue;
+        for (u32 i = 1; i + 1 < triangles.count; ++i)
+        {
+            polygon_draw::DrawWireframeTriangle(triangles.v[0], triangles.v[i], triangles.v[i + 1], RED);
+        }
+    });
+}
+
+template <typename Index>
+static void
+DrawObjectSolidWireframe(Object3D *O, const Index *indices, const model_lod& lod)
+{
+    assert(O != nullptr);
+
+    ForEachVisibleTriangle(O, indices, lod, true, [&](const assembled_triangles& triangles)
+    {
+        if (!triangles.IsIn) return;
+        globalFrameStats.trianglesDrawn += triangles.count - 2;
 
         if (globalRenderNormals) 
         {
-            polygon_draw::DrawNormal(triangles.v0);
-            polygon_draw::DrawNormal(triangles.v1);
-            polygon_draw::DrawNormal(triangles.v2);
+            polygon_draw::DrawNormal(triangles.v[0].view);
+            polygon_draw::DrawNormal(triangles.v[1].view);
+            polygon_draw::DrawNormal(triangles.v[2].view);
         }
-        polygon_draw::ShadeTriangleInMode(triangles.v0, triangles.v1, triangles.v2, globalOmniLight, globalAmbientLight.intensity, globalShadingMode);
 
-        if (triangles.IsSplit)
+        for (u32 i = 1; i + 1 < triangles.count; ++i)
         {
-            polygon_draw::ShadeTriangleInMode(triangles.v0, triangles.v2, triangles.v3, globalOmniLight, globalAmbientLight.intensity, globalShadingMode);
+            polygon_draw::DrawWireframeTriangle(triangles.v[0], triangles.v[i], triangles.v[i + 1], YELLOW);
+            polygon_draw::ShadeTriangleInMode(triangles.v[0], triangles.v[i], triangles.v[i + 1], globalOmniLight, globalAmbientLight.intensity, globalShadingMode);
+        }
+    });
+}
+
+// The triangle loops are instantiated per index width, so they never check it
+template <typename Index>
+static void
+DrawObjectIndexed(Object3D *O, const Index *indices, const model_lod& lod)
+{
+    if (globalRenderMode == RENDER_SOLID)
+        DrawObjectSolid(O, indices, lod);
+    else if (globalRenderMode == RENDER_WIREFRAME)
+        DrawObjectWireframe(O, indices, lod);
+    else if (globalRenderMode == RENDER_SOLID_WIREFRAME)
+        DrawObjectSolidWireframe(O, indices, lod);
+}
+
+// The coarsest level of detail whose error stays within globalLodErrorPixels on screen. The
+// error is measured at the nearest point of the bounding sphere, objects reaching behind the
+// camera always get the full mesh.
+static const model_lod&
+SelectObjectLod(Object3D *O)
+{
+    const Model3D *M = O->ObjectModel;
+    u32 level = 0;
+    sphere viewSphere = globalCamera.ObjectViewSphere(O);
+    f32 nearest = viewSphere.center.z - viewSphere.radius;
+    if (globalLodErrorPixels > 0 && nearest > 0)
+    {
+        f32 pixelsPerUnit = screen_draw::ProjectedLength(O->scale, nearest);
+        while (level + 1 < M->lodCount && M->Lods[level + 1].error * pixelsPerUnit <= globalLodErrorPixels)
+        {
+            ++level;
         }
     }
+    return M->Lods[level];
 }
 
 static void
-DrawObjectWireframe(Object3D *O)
+DrawObjectInMode(Object3D *O, u32 index)
 {
-    assert(O != nullptr);
+#ifdef PERF_ON
+    const u64 vertices = globalPerf.counters[PERF_VERTICES];
+    const u64 trianglesIn = globalPerf.counters[PERF_TRIANGLES_IN];
+    const u64 trianglesDrawn = globalFrameStats.trianglesDrawn;
+    const auto start = std::chrono::steady_clock::now();
+#endif
+
+    const Model3D *M = O->ObjectModel;
+    const model_lod& lod = SelectObjectLod(O);
+    if (M->Indices16 != nullptr)
+        DrawObjectIndexed(O, M->Indices16, lod);
+    else
+        DrawObjectIndexed(O, M->Indices32, lod);
+
+#ifdef PERF_ON
+    globalPerf.objects.push_back(
+    {
+        index,
+        static_cast<u32>(globalPerf.counters[PERF_VERTICES] - vertices),
+        static_cast<u32>(globalPerf.counters[PERF_TRIANGLES_IN] - trianglesIn),
+        static_cast<u32>(globalFrameStats.trianglesDrawn - trianglesDrawn),
+        PerfMsSince(start)
+    });
+#else
+    (void) index;
+#endif
+}
+
+static void
+DrawObject(u8 index)
+{
+    if (index >= worldObjects.size() || worldObjects.size() <= 0) return;
 
     // Preliminary culling based on bounding volume (sphere here)
-    if (!globalCamera.ObjectInFrustum(O))
+    PERF_COUNT(globalPerf, PERF_OBJECTS_IN, 1);
+    if (!globalCamera.ObjectInFrustum(worldObjects[index]))
     {
+        PERF_COUNT(globalPerf, PERF_OBJECTS_CULLED, 1);
         return;
     }
 
-    mat4x4 transform = O->ObjectTransform();
-    mat4x4 rot = O->ObjectRotation();
-    for (int i = 0; i < O->ObjectModel->in / 3; ++i)
-    {
-        // Cull backfaces and faces outside frustum
-        ClippedTriangle triangles = ProcessTriangle(i, O, transform, rot, false);
+    DrawObjectInMode(worldObjects[index], index);
+}
 
-        if (!triangles.IsIn) continue;
-        
-        if (globalRenderNormals) 
+// Culls every world object by its bounding sphere before any of its triangles are touched
+// and draws the survivors front to back, so the depth test rejects more of the hidden work.
+// Instances of the same model are drawn back to back so its vertex data stays in cache, the
+// batches go in the order of their nearest instance.
+static void
+DrawScene()
+{
+    std::vector<visible_object>& visible = globalVisibleObjects;
+    visible.clear();
+    for (u32 i = 0; i < worldObjects.size(); ++i)
+    {
+        sphere viewSphere = globalCamera.ObjectViewSphere(worldObjects[i]);
+        if (globalCamera.ViewSphereInFrustum(viewSphere))
         {
-            polygon_draw::DrawNormal(triangles.v0);
-            polygon_draw::DrawNormal(triangles.v1);
-            polygon_draw::DrawNormal(triangles.v2);
+            visible.push_back({worldObjects[i], viewSphere.center.z - viewSphere.radius, 0, i});
         }
+    }
+    PERF_COUNT(globalPerf, PERF_OBJECTS_IN, worldObjects.size());
+    PERF_COUNT(globalPerf, PERF_OBJECTS_CULLED, worldObjects.size() - visible.size());
+
+    std::sort(visible.begin(), visible.end(), [](const visible_object& a, const visible_object& b) { return a.depth < b.depth; });
+
+    globalModelBatches.clear();
+    for (visible_object& v : visible)
+    {
+        auto batch = globalModelBatches.emplace(v.object->ObjectModel, static_cast<u32>(globalModelBatches.size()));
+        v.batch = batch.first->second;
+    }
+    std::stable_sort(visible.begin(), visible.end(), [](const visible_object& a, const visible_object& b) { return a.batch < b.batch; });
+
+    for (const visible_object& v : visible)
+    {
+        DrawObjectInMode(v.object, v.index);
+    }
+}
 
-        polygon_draw::DrawWireframeTriangle(triangles.v0, triangles.v1, triangles.v2, RED);
-        if (triangles.IsSplit)
+// MODEL LOADING ------------------------------------------------------------------------
+// OnLaunch hands the files to loader threads, each with a worker_pool of its own for chunked
+// parsing, and every frame places the models that came back. The render thread never waits.
+static void
+LoaderThread(i32 workerCount)
+{
+    worker_pool workers;
+    workers.Start(workerCount);
+    for (u32 file = globalNextLoadFile++; file < globalLoadFiles.size(); file = globalNextLoadFile++)
+    {
+        f64 parseMs;
+        Model3D *Model = LoadModelFromOBJ(globalLoadFiles[file], &workers, globalUseMeshCache, &parseMs);
+        if (Model != nullptr && globalPackModels)
         {
-            polygon_draw::DrawWireframeTriangle(triangles.v0, triangles.v1, triangles.v2, RED);
+            PackModel(Model);
         }
+        globalLoadedModels.Push({file, Model, parseMs});
     }
 }
 
+// Instances are placed on a grid going into the screen, every model starts on the row after the
+// ones already placed so models loaded together don't end up inside each other
 static void
-DrawObjectSolidWireframe(Object3D *O)
+PlaceInstances(Model3D *Model, i32 instances)
 {
-    assert(O != nullptr);
+    i32 columns = static_cast<i32>(std::ceil(std::sqrt(static_cast<f32>(instances))));
+    const f32 spacing = 25.0f;
+    for (i32 i = 0; i < instances; ++i)
+    {
+        f32 x = (i % columns - (columns - 1) * 0.5f) * spacing;
+        f32 z = 20.0f + (globalPlacementRow + i / columns) * spacing;
+        worldObjects.push_back(CreateObjectInstance(Model, {x, 0, z}, 10.f));
+    }
+    globalPlacementRow += (instances + columns - 1) / columns;
+}
 
-    // Preliminary culling based on bounding volume (sphere here)
-    if (!globalCamera.ObjectInFrustum(O))
+// Packs or unpacks every model in the world to match globalPackModels, each model once and all
+// of them at the same time on the worker pool
+static void
+SetModelStorage()
+{
+    std::vector<Model3D *> models;
+    for (Object3D *O : worldObjects)
     {
-        return;
+        models.push_back(O->ObjectModel);
     }
+    std::sort(models.begin(), models.end());
+    models.erase(std::unique(models.begin(), models.end()), models.end());
 
-    mat4x4 transform = O->ObjectTransform();
-    mat4x4 rot = O->ObjectRotation();
-    for (int i = 0; i < O->ObjectModel->in / 3; ++i)
+    const bool pack = globalPackModels;
+    globalWorkers.ParallelFor(static_cast<i32>(models.size()), [&](i32 i)
     {
-        ClippedTriangle triangles = ProcessTriangle(i, O, transform, rot);
+        if (pack)
+        {
+            PackModel(models[i]);
+        }
+        else
+        {
+            UnpackModel(models[i]);
+        }
+    });
+}
 
-        if (!triangles.IsIn) continue;
+// Places the instances of every model that finished loading since the last call
+static void
+AddLoadedModels()
+{
+    if (globalLoadsInFlight == 0)
+    {
+        return;
+    }
 
-        if (globalRenderNormals) 
+    std::vector<loaded_model> loaded;
+    globalLoadedModels.PopAll(loaded);
+    for (const loaded_model& result : loaded)
+    {
+        --globalLoadsInFlight;
+        globalLoadParseMs += result.parseMs;
+        if (result.model == nullptr)
         {
-            polygon_draw::DrawNormal(triangles.v0);
-            polygon_draw::DrawNormal(triangles.v1);
-            polygon_draw::DrawNormal(triangles.v2);
+            continue;
         }
 
-        polygon_draw::DrawWireframeTriangle(triangles.v0, triangles.v1, triangles.v2, YELLOW);
-        polygon_draw::ShadeTriangleInMode(triangles.v0, triangles.v1, triangles.v2, globalOmniLight, globalAmbientLight.intensity, globalShadingMode);
+        const std::string& name = globalLoadFiles[result.file];
+        LoadedModels[name] = result.model;
+        // The loader already did this unless c or v was pressed while the model was loading
+        if (globalPackModels)
+        {
+            PackModel(result.model);
+        }
+        else
+        {
+            UnpackModel(result.model);
+        }
+        for (const pending_load& entry : globalPendingLoads)
+        {
+            if (entry.name == name)
+            {
+                PlaceInstances(result.model, entry.instances);
+                globalSceneChanged = true;
+            }
+        }
+    }
 
-        if (triangles.IsSplit)
+    if (!loaded.empty() && globalLoadsInFlight == 0)
+    {
+        globalPendingLoads.clear();
+        std::cout << "NUMBER OF LOADED OBJECTS: " << worldObjects.size() << std::endl;
+        if (worldObjects.size() == 0)
         {
-            polygon_draw::DrawWireframeTriangle(triangles.v0, triangles.v1, triangles.v2, YELLOW);
-            polygon_draw::ShadeTriangleInMode(triangles.v0, triangles.v2, triangles.v3, globalOmniLight, globalAmbientLight.intensity, globalShadingMode);
+            Object3D *Cube = CreateCube({0, 0, 12}, 4);
+            if (globalPackModels)
+            {
+                PackModel(Cube->ObjectModel);
+            }
+            worldObjects.push_back(Cube);
         }
     }
 }
 
-static void
-DrawObject(u8 index)
+void
+FinishLoading()
 {
-    if (index >= worldObjects.size() || worldObjects.size() <= 0) return;
+    for (std::thread& loader : globalLoaders)
+    {
+        loader.join();
+    }
+    globalLoaders.clear();
+    AddLoadedModels();
+}
 
-    if (globalRenderMode == RENDER_SOLID)
-        DrawObjectSolid(worldObjects[index]);
-    else if (globalRenderMode == RENDER_WIREFRAME)
-        DrawObjectWireframe(worldObjects[index]);
-    else if (globalRenderMode == RENDER_SOLID_WIREFRAME)
-        DrawObjectSolidWireframe(worldObjects[index]);
+void
+SetLodErrorThreshold(f32 Pixels)
+{
+    globalLodErrorPixels = std::max(Pixels, 0.0f);
+}
+
+void
+SetMeshCache(bool Enabled)
+{
+    globalUseMeshCache = Enabled;
 }
 
 void
 ProcessInput(KeyCode Key)
 {
+    // Moving the light is the one change the G-buffer survives
+    if (Key != KEY_UP && Key != KEY_DOWN && Key != KEY_LEFT && Key != KEY_RIGHT && Key != KEY_H)
+    {
+        globalSceneChanged = true;
+    }
+
     if (Key == KEY_F)
     {
         globalShadingMode = SHADE_FLAT;
@@ -684,6 +1376,16 @@ ProcessInput(KeyCode Key)
         globalShadingMode = SHADE_GOURAUD;
     }
 
+    if (Key == KEY_Z)
+    {
+        globalShadingMode = SHADE_PHONG_PREPASS;
+    }
+
+    if (Key == KEY_R)
+    {
+        globalShadingMode = SHADE_DEFERRED;
+    }
+
     if (Key == KEY_D)
     {
         globalRenderMode = RENDER_SOLID_WIREFRAME;
@@ -709,12 +1411,12 @@ ProcessInput(KeyCode Key)
         globalCamera.MoveBy(vec3f{0.f, 5.f, 0.f} * globalDeltaTime);
     }
 
-    if (Key == KEY_Q)
+    if (Key == KEY_Q && globalObjectCursor < worldObjects.size())
     {
         worldObjects[globalObjectCursor]->RotateObjectY(60 * globalDeltaTime);
     }
 
-    if (Key == KEY_E)
+    if (Key == KEY_E && globalObjectCursor < worldObjects.size())
     {
         worldObjects[globalObjectCursor]->RotateObjectY(-60 * globalDeltaTime);
     }
@@ -739,6 +1441,38 @@ ProcessInput(KeyCode Key)
         globalOmniLight.position += vec3f{50, 0, 0} * globalDeltaTime;
     }
 
+    if (Key == KEY_A)
+    {
+        globalRenderScene = true;
+    }
+
+    if (Key == KEY_C && !globalPackModels)
+    {
+        globalPackModels = true;
+        SetModelStorage();
+    }
+
+    if (Key == KEY_V && globalPackModels)
+    {
+        globalPackModels = false;
+        SetModelStorage();
+    }
+
+    if (Key == KEY_L)
+    {
+        const f32 presets[] = { 1.0f, 2.0f, 4.0f, 0.0f, 0.5f };
+        size_t next = 0;
+        for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); ++i)
+        {
+            if (presets[i] == globalLodErrorPixels) next = (i + 1) % (sizeof(presets) / sizeof(presets[0]));
+        }
+        SetLodErrorThreshold(presets[next]);
+        if (globalLodErrorPixels > 0)
+            std::cout << "Level of detail error: " << globalLodErrorPixels << " pixels" << std::endl;
+        else
+            std::cout << "Level of detail: off" << std::endl;
+    }
+
     if (Key == KEY_N)
     {
         globalRenderNormals = !globalRenderNormals;
@@ -752,46 +1486,55 @@ ProcessInput(KeyCode Key)
     if (Key == KEY_1)
     {
         globalObjectCursor = 0;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_2)
     {
         globalObjectCursor = 1;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_3)
     {
         globalObjectCursor = 2;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_4)
     {
         globalObjectCursor = 3;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_5)
     {
         globalObjectCursor = 4;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_6)
     {
         globalObjectCursor = 5;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_7)
     {
         globalObjectCursor = 6;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_8)
     {
         globalObjectCursor = 7;
+        globalRenderScene = false;
     }
 
     if (Key == KEY_9)
     {
         globalObjectCursor = 8;
+        globalRenderScene = false;
     }
 }
 
@@ -800,6 +1543,13 @@ OnLaunch(PlatformScreenDevice screenDevice, const std::vector<std::string>& obje
 {
     globalScreenDevice = screenDevice;
     globalDepthBuffer = new f32[globalScreenDevice.width * globalScreenDevice.height];
+    globalHiZ.assign(((globalScreenDevice.width + RASTER_HIZ_BLOCK - 1) >> RASTER_HIZ_BITS) *
+                     ((globalScreenDevice.height + RASTER_HIZ_BLOCK - 1) >> RASTER_HIZ_BITS), raster_hiz_block());
+    globalTiles.Resize(globalScreenDevice.width, globalScreenDevice.height);
+    globalBaseColorBuffer.assign(globalScreenDevice.width * globalScreenDevice.height, 0);
+    globalNormalBuffer.assign(globalScreenDevice.width * globalScreenDevice.height, vec3f{0, 0, 0});
+    globalGuardBand = { RASTER_GUARD_BAND / (0.5f * globalScreenDevice.width), RASTER_GUARD_BAND / (0.5f * globalScreenDevice.height) };
+    globalWorkers.Start(std::max(static_cast<i32>(std::thread::hardware_concurrency()) - 1, 0));
     globalRenderMode = RENDER_SOLID;
     globalShadingMode = SHADE_FLAT;
     globalOmniLight = point_light({-4, 10, 8}, 0.8f, 10.0f);
@@ -810,41 +1560,124 @@ OnLaunch(PlatformScreenDevice screenDevice, const std::vector<std::string>& obje
     vec3f origin = {0,0,0};
     globalCamera = camera(origin, focalLength, vFov, globalScreenDevice.aspectRatio, I_MATRIX_3X3);
 
+    globalObjectCursor = 0;
+    globalRenderScene = false;
+    globalPackModels = false;
+    globalLodErrorPixels = 1.0f;
+    globalSceneChanged = true;
+
     std::cout << "NUMBER OF OBJ FILES: " << objects.size() << std::endl;
+    globalPendingLoads.clear();
+    globalLoadFiles.clear();
     for (const auto& obj : objects)
     {
-        Object3D *O = LoadObjectFromOBJ(obj.c_str(), {0,0,20}, 10.f);
-        if (O != nullptr)
+        pending_load entry = {obj, 1};
+        size_t colon = obj.rfind(':');
+        if (colon != std::string::npos)
+        {
+            entry.name = obj.substr(0, colon);
+            entry.instances = std::max(std::atoi(obj.c_str() + colon + 1), 1);
+        }
+        globalPendingLoads.push_back(entry);
+
+        if (std::find(globalLoadFiles.begin(), globalLoadFiles.end(), entry.name) == globalLoadFiles.end())
         {
-            worldObjects.push_back(O);
+            globalLoadFiles.push_back(entry.name);
         }
     }
-    std::cout << "NUMBER OF LOADED OBJECTS: " << worldObjects.size() << std::endl;
 
-    if (worldObjects.size() == 0)
+    // Several files load at once, a single file gets the whole machine for its parse
+    i32 threads = std::max(static_cast<i32>(std::thread::hardware_concurrency()), 1);
+    i32 loaderCount = std::min(static_cast<i32>(globalLoadFiles.size()), threads);
+    globalLoadsInFlight = static_cast<u32>(globalLoadFiles.size());
+    globalPlacementRow = 0;
+    globalLoadParseMs = 0.0;
+    globalNextLoadFile = 0;
+    for (i32 i = 0; i < loaderCount; ++i)
+    {
+        globalLoaders.emplace_back(LoaderThread, threads / loaderCount - 1);
+    }
+
+    if (globalLoadFiles.empty())
     {
+        std::cout << "NUMBER OF LOADED OBJECTS: 0" << std::endl;
         worldObjects.push_back(CreateCube({0, 0, 12}, 4));
     }
-    
+
     std::cout << globalHelpString << std::endl;
 }
 
 void
 OnShutdown()
 {
+    FinishLoading();
+    globalWorkers.Stop();
     delete[] globalDepthBuffer;
+    globalDepthBuffer = nullptr;
     for (auto obj : worldObjects)
     {
         DestroyObject3D(obj);
     }
+    worldObjects.clear();
+}
+
+RenderStats
+LastFrameStats()
+{
+    return globalFrameStats;
+}
+
+const PerfFrame&
+LastFramePerf()
+{
+    return globalPerf;
+}
+
+f64
+LoadParseMs()
+{
+    return globalLoadParseMs;
 }
 
 void
 UpdateRenderLoop(f32 deltaTime)
 {
+    AddLoadedModels();
     globalDeltaTime = deltaTime;
-    screen_draw::BlackoutScreenBuffer(BLACK);
-    DrawObject(globalObjectCursor);
+    globalFrameStats = {};
+    PERF_ONLY(PerfReset(globalPerf));
+
+    // When only the light moved, last frame's G-buffer and lines are still what the camera sees
+    const bool deferred = globalShadingMode == SHADE_DEFERRED && globalRenderMode != RENDER_WIREFRAME;
+    if (!deferred || globalSceneChanged)
+    {
+        {
+            PERF_TIMED_STAGE(globalPerf, PERF_STAGE_CLEAR);
+            screen_draw::BlackoutScreenBuffer(BLACK);
+        }
+        {
+            PERF_TIMED_STAGE(globalPerf, PERF_STAGE_VERTEX);
+            if (globalRenderScene)
+            {
+                DrawScene();
+            }
+            else
+            {
+                DrawObject(globalObjectCursor);
+            }
+        }
+        {
+            PERF_TIMED_STAGE(globalPerf, PERF_STAGE_RASTER);
+            polygon_draw::RasterizeBinnedTriangles();
+        }
+        globalSceneChanged = false;
+    }
+
+    if (deferred)
+    {
+        PERF_TIMED_STAGE(globalPerf, PERF_STAGE_LIGHTING);
+        polygon_draw::LightGBuffer(globalOmniLight, globalAmbientLight.intensity);
+    }
 }
 // CORE APPLICATION END HERE --------------------------------------------------------------
 } // namespace rastertoy
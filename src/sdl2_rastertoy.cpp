@@ -22,9 +22,10 @@ struct sdl_render_resources
 
 static PlatformState WindowState = WINDOW_RUNNING;
 static bool SDLCursorShown = true;
+static bool SDLLodKeyWasDown = false;
 static const i32 WINDOW_WIDTH = 1280;
 static const f32 WINDOW_ASPECT_RATIO = 16.0f / 9.0f;
-static const std::string CORRECT_USAGE_STRING = "Correct Usage: ./sdl2_rastertoy.exe [list of obj files]";
+static const std::string CORRECT_USAGE_STRING = "Correct Usage: ./sdl2_rastertoy.exe [list of obj files, each optionally followed by :instance_count]";
 
 static bool SDLInitializeVideo();
 [[nodiscard]] static sdl_render_resources SDLCreateRenderingResourses
@@ -93,6 +94,9 @@ main(int argc, char *argv[])
         }
 
         // Buffer Presentation -----------------------------------------------
+#if defined(DEBUG_ON) && defined(PERF_ON)
+        unsigned long long presentCounter = SDL_GetPerformanceCounter();
+#endif
         SDLRenderBackBuffer(sdlRenderResources);
 
         // Timing ------------------------------------------------------------
@@ -106,13 +110,25 @@ main(int argc, char *argv[])
         std::string newTitle = windowTitle + " | Time: " + std::to_string(MSPerFrame) + "ms";
         SDL_SetWindowTitle(sdlRenderResources.window, newTitle.c_str());
 #if defined(DEBUG_ON) && defined(PERF_ON)
-        std::cout << "Frame Time: " << MSPerFrame << "ms | FPS: " << FPS << "\n";
+        PerfFrame perf = rastertoy::LastFramePerf();
+        perf.stageMs[PERF_STAGE_PRESENT] = 1000.0 * (EndCounter - presentCounter) / counterFrequency;
+        std::cout << "Frame Time: " << MSPerFrame << "ms | FPS: " << FPS;
+        for (i32 stage = 0; stage < PERF_STAGE_COUNT; ++stage)
+        {
+            std::cout << " | " << PerfStageName(stage) << ": " << perf.stageMs[stage] << "ms";
+        }
+        std::cout << "\n";
+        for (i32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+        {
+            std::cout << "    " << PerfCounterName(counter) << ": " << perf.counters[counter] << "\n";
+        }
 #endif
         lastCounter = EndCounter;
         deltaTime = MSPerFrame;
     }
 
     // Resource Release -----------------------------------------------------
+    rastertoy::OnShutdown();
     SDLReleaseResources(sdlRenderResources);
     SDL_Quit();
 
@@ -337,6 +353,39 @@ void SDLSendKeyboardState()
         rastertoy::ProcessInput(KEY_LCTRL);
     }
 
+    if (keyState[SDL_SCANCODE_A])
+    {
+        rastertoy::ProcessInput(KEY_A);
+    }
+
+    if (keyState[SDL_SCANCODE_C])
+    {
+        rastertoy::ProcessInput(KEY_C);
+    }
+
+    if (keyState[SDL_SCANCODE_V])
+    {
+        rastertoy::ProcessInput(KEY_V);
+    }
+
+    // L steps through presets, so it fires once per press instead of every frame it is held
+    bool lodKeyDown = keyState[SDL_SCANCODE_L] != 0;
+    if (lodKeyDown && !SDLLodKeyWasDown)
+    {
+        rastertoy::ProcessInput(KEY_L);
+    }
+    SDLLodKeyWasDown = lodKeyDown;
+
+    if (keyState[SDL_SCANCODE_Z])
+    {
+        rastertoy::ProcessInput(KEY_Z);
+    }
+
+    if (keyState[SDL_SCANCODE_R])
+    {
+        rastertoy::ProcessInput(KEY_R);
+    }
+
     if (keyState[SDL_SCANCODE_0])
     {
         rastertoy::ProcessInput(KEY_0);
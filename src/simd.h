@@ -0,0 +1,152 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+Thin wrappers over the SIMD instruction sets the rasterizer kernels use. The widest one the
+compiler is allowed to emit gets picked at compile time:
+    AVX2    8 lanes (-mavx2 or /arch:AVX2)
+    SSE2    4 lanes (any x86-64 build)
+    scalar  1 lane  (everything else)
+Masks are simd_i32 with all bits set in the active lanes.
+*/
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SIMD_SSE2
+#else
+    #define SIMD_SCALAR
+#endif
+
+#if defined(SIMD_AVX2)
+
+const i32 SIMD_WIDTH = 8;
+typedef __m256 simd_f32;
+typedef __m256i simd_i32;
+
+inline simd_f32 simd_set1_f32(f32 v) { return _mm256_set1_ps(v); }
+inline simd_i32 simd_set1_i32(i32 v) { return _mm256_set1_epi32(v); }
+inline simd_f32 simd_ramp_f32(f32 base, f32 step) { return _mm256_add_ps(_mm256_set1_ps(base), _mm256_mul_ps(_mm256_set1_ps(step), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7))); }
+inline simd_i32 simd_ramp_i32(i32 base, i32 step) { return _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_mullo_epi32(_mm256_set1_epi32(step), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))); }
+
+inline simd_f32 simd_loadu_f32(const f32 *p) { return _mm256_loadu_ps(p); }
+inline simd_i32 simd_loadu_i32(const u32 *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+inline void simd_storeu_f32(f32 *p, simd_f32 v) { _mm256_storeu_ps(p, v); }
+inline void simd_storeu_i32(u32 *p, simd_i32 v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+
+inline simd_f32 simd_add_f32(simd_f32 a, simd_f32 b) { return _mm256_add_ps(a, b); }
+inline simd_f32 simd_mul_f32(simd_f32 a, simd_f32 b) { return _mm256_mul_ps(a, b); }
+inline simd_f32 simd_min_f32(simd_f32 a, simd_f32 b) { return _mm256_min_ps(a, b); }
+inline simd_f32 simd_max_f32(simd_f32 a, simd_f32 b) { return _mm256_max_ps(a, b); }
+inline simd_i32 simd_add_i32(simd_i32 a, simd_i32 b) { return _mm256_add_epi32(a, b); }
+inline simd_i32 simd_or_i32(simd_i32 a, simd_i32 b) { return _mm256_or_si256(a, b); }
+inline simd_i32 simd_and_i32(simd_i32 a, simd_i32 b) { return _mm256_and_si256(a, b); }
+inline simd_i32 simd_shl_i32(simd_i32 a, i32 bits) { return _mm256_slli_epi32(a, bits); }
+inline simd_i32 simd_truncate_f32(simd_f32 a) { return _mm256_cvttps_epi32(a); }
+
+inline simd_i32 simd_cmpgt_i32(simd_i32 a, simd_i32 b) { return _mm256_cmpgt_epi32(a, b); }
+inline simd_i32 simd_cmpgt_f32(simd_f32 a, simd_f32 b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+inline simd_i32 simd_cmpeq_f32(simd_f32 a, simd_f32 b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+inline simd_f32 simd_select_f32(simd_i32 mask, simd_f32 a, simd_f32 b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask)); }
+inline simd_i32 simd_select_i32(simd_i32 mask, simd_i32 a, simd_i32 b) { return _mm256_blendv_epi8(b, a, mask); }
+inline i32 simd_mask_bits(simd_i32 mask) { return _mm256_movemask_ps(_mm256_castsi256_ps(mask)); }
+
+#elif defined(SIMD_SSE2)
+
+const i32 SIMD_WIDTH = 4;
+typedef __m128 simd_f32;
+typedef __m128i simd_i32;
+
+inline simd_f32 simd_set1_f32(f32 v) { return _mm_set1_ps(v); }
+inline simd_i32 simd_set1_i32(i32 v) { return _mm_set1_epi32(v); }
+inline simd_f32 simd_ramp_f32(f32 base, f32 step) { return _mm_add_ps(_mm_set1_ps(base), _mm_mul_ps(_mm_set1_ps(step), _mm_setr_ps(0, 1, 2, 3))); }
+inline simd_i32 simd_ramp_i32(i32 base, i32 step) { return _mm_setr_epi32(base, base + step, base + 2 * step, base + 3 * step); }
+
+inline simd_f32 simd_loadu_f32(const f32 *p) { return _mm_loadu_ps(p); }
+inline simd_i32 simd_loadu_i32(const u32 *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+inline void simd_storeu_f32(f32 *p, simd_f32 v) { _mm_storeu_ps(p, v); }
+inline void simd_storeu_i32(u32 *p, simd_i32 v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+
+inline simd_f32 simd_add_f32(simd_f32 a, simd_f32 b) { return _mm_add_ps(a, b); }
+inline simd_f32 simd_mul_f32(simd_f32 a, simd_f32 b) { return _mm_mul_ps(a, b); }
+inline simd_f32 simd_min_f32(simd_f32 a, simd_f32 b) { return _mm_min_ps(a, b); }
+inline simd_f32 simd_max_f32(simd_f32 a, simd_f32 b) { return _mm_max_ps(a, b); }
+inline simd_i32 simd_add_i32(simd_i32 a, simd_i32 b) { return _mm_add_epi32(a, b); }
+inline simd_i32 simd_or_i32(simd_i32 a, simd_i32 b) { return _mm_or_si128(a, b); }
+inline simd_i32 simd_and_i32(simd_i32 a, simd_i32 b) { return _mm_and_si128(a, b); }
+inline simd_i32 simd_shl_i32(simd_i32 a, i32 bits) { return _mm_slli_epi32(a, bits); }
+inline simd_i32 simd_truncate_f32(simd_f32 a) { return _mm_cvttps_epi32(a); }
+
+inline simd_i32 simd_cmpgt_i32(simd_i32 a, simd_i32 b) { return _mm_cmpgt_epi32(a, b); }
+inline simd_i32 simd_cmpgt_f32(simd_f32 a, simd_f32 b) { return _mm_castps_si128(_mm_cmpgt_ps(a, b)); }
+inline simd_i32 simd_cmpeq_f32(simd_f32 a, simd_f32 b) { return _mm_castps_si128(_mm_cmpeq_ps(a, b)); }
+inline simd_f32 simd_select_f32(simd_i32 mask, simd_f32 a, simd_f32 b)
+{
+    __m128 m = _mm_castsi128_ps(mask);
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+inline simd_i32 simd_select_i32(simd_i32 mask, simd_i32 a, simd_i32 b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+inline i32 simd_mask_bits(simd_i32 mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask)); }
+
+#else
+
+const i32 SIMD_WIDTH = 1;
+typedef f32 simd_f32;
+typedef i32 simd_i32;
+
+inline simd_f32 simd_set1_f32(f32 v) { return v; }
+inline simd_i32 simd_set1_i32(i32 v) { return v; }
+inline simd_f32 simd_ramp_f32(f32 base, f32 step) { return base; }
+inline simd_i32 simd_ramp_i32(i32 base, i32 step) { return base; }
+
+inline simd_f32 simd_loadu_f32(const f32 *p) { return *p; }
+inline simd_i32 simd_loadu_i32(const u32 *p) { return static_cast<i32>(*p); }
+inline void simd_storeu_f32(f32 *p, simd_f32 v) { *p = v; }
+inline void simd_storeu_i32(u32 *p, simd_i32 v) { *p = static_cast<u32>(v); }
+
+inline simd_f32 simd_add_f32(simd_f32 a, simd_f32 b) { return a + b; }
+inline simd_f32 simd_mul_f32(simd_f32 a, simd_f32 b) { return a * b; }
+inline simd_f32 simd_min_f32(simd_f32 a, simd_f32 b) { return a < b ? a : b; }
+inline simd_f32 simd_max_f32(simd_f32 a, simd_f32 b) { return a > b ? a : b; }
+inline simd_i32 simd_add_i32(simd_i32 a, simd_i32 b) { return a + b; }
+inline simd_i32 simd_or_i32(simd_i32 a, simd_i32 b) { return a | b; }
+inline simd_i32 simd_and_i32(simd_i32 a, simd_i32 b) { return a & b; }
+inline simd_i32 simd_shl_i32(simd_i32 a, i32 bits) { return static_cast<i32>(static_cast<u32>(a) << bits); }
+inline simd_i32 simd_truncate_f32(simd_f32 a) { return static_cast<i32>(a); }
+
+inline simd_i32 simd_cmpgt_i32(simd_i32 a, simd_i32 b) { return a > b ? -1 : 0; }
+inline simd_i32 simd_cmpgt_f32(simd_f32 a, simd_f32 b) { return a > b ? -1 : 0; }
+inline simd_i32 simd_cmpeq_f32(simd_f32 a, simd_f32 b) { return a == b ? -1 : 0; }
+inline simd_f32 simd_select_f32(simd_i32 mask, simd_f32 a, simd_f32 b) { return mask ? a : b; }
+inline simd_i32 simd_select_i32(simd_i32 mask, simd_i32 a, simd_i32 b) { return mask ? a : b; }
+inline i32 simd_mask_bits(simd_i32 mask) { return mask & 1; }
+
+#endif
+
+// Number of active lanes in a mask
+inline i32
+simd_mask_count(simd_i32 mask)
+{
+    i32 bits = simd_mask_bits(mask);
+    bits = bits - ((bits >> 1) & 0x55);
+    bits = (bits & 0x33) + ((bits >> 2) & 0x33);
+    return (bits + (bits >> 4)) & 0x0F;
+}
+
+// Packs 0-255 float channels into RGBA8888 the same way color_uint32 does
+inline simd_i32
+simd_pack_rgba(simd_f32 r, simd_f32 g, simd_f32 b, simd_i32 a)
+{
+    const simd_f32 zero = simd_set1_f32(0.0f);
+    const simd_f32 full = simd_set1_f32(255.0f);
+    simd_i32 ri = simd_truncate_f32(simd_min_f32(simd_max_f32(r, zero), full));
+    simd_i32 gi = simd_truncate_f32(simd_min_f32(simd_max_f32(g, zero), full));
+    simd_i32 bi = simd_truncate_f32(simd_min_f32(simd_max_f32(b, zero), full));
+
+    return simd_or_i32(simd_or_i32(simd_shl_i32(ri, 24), simd_shl_i32(gi, 16)),
+                       simd_or_i32(simd_shl_i32(bi, 8), a));
+}
+
+#endif // SIMD_H
@@ -0,0 +1,77 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include "rasterizer.h"
+
+#include <vector>
+
+const i32 TILE_SIZE = 64;
+
+/*
+Splits the screen into TILE_SIZE x TILE_SIZE tiles. Each tile keeps a bin with the indices of
+the triangles whose bounding box touches it, in submission order, so tiles can be rasterized
+independently of each other.
+*/
+struct screen_tiles
+{
+    std::vector<std::vector<u32>> bins;
+    i32 columns;
+    i32 rows;
+    i32 width;
+    i32 height;
+
+    void Resize(i32 screenWidth, i32 screenHeight)
+    {
+        width = screenWidth;
+        height = screenHeight;
+        columns = (screenWidth + TILE_SIZE - 1) / TILE_SIZE;
+        rows = (screenHeight + TILE_SIZE - 1) / TILE_SIZE;
+        bins.assign(columns * rows, std::vector<u32>());
+    }
+
+    i32 Count() const { return columns * rows; }
+
+    void ClearBins()
+    {
+        for (auto& bin : bins)
+        {
+            bin.clear();
+        }
+    }
+
+    // Bounding box in pixels, triangles completely off screen are dropped
+    void Bin(u32 index, f32 minX, f32 minY, f32 maxX, f32 maxY)
+    {
+        // Written so that NaNs fail
+        if (!(maxX >= 0 && maxY >= 0 && minX < width && minY < height))
+        {
+            return;
+        }
+
+        // One pixel of slack for the sub-pixel snapping
+        i32 firstColumn = static_cast<i32>(std::max(minX - 1, 0.0f)) / TILE_SIZE;
+        i32 firstRow = static_cast<i32>(std::max(minY - 1, 0.0f)) / TILE_SIZE;
+        i32 lastColumn = static_cast<i32>(std::min(maxX + 1, width - 1.0f)) / TILE_SIZE;
+        i32 lastRow = static_cast<i32>(std::min(maxY + 1, height - 1.0f)) / TILE_SIZE;
+
+        for (i32 row = firstRow; row <= lastRow; ++row)
+        {
+            for (i32 column = firstColumn; column <= lastColumn; ++column)
+            {
+                bins[row * columns + column].push_back(index);
+            }
+        }
+    }
+
+    // The screen target scissored to a single tile
+    raster_target TileTarget(raster_target screen, i32 tile) const
+    {
+        screen.minX = (tile % columns) * TILE_SIZE;
+        screen.minY = (tile / columns) * TILE_SIZE;
+        screen.maxX = std::min(screen.minX + TILE_SIZE, width);
+        screen.maxY = std::min(screen.minY + TILE_SIZE, height);
+        return screen;
+    }
+};
+
+#endif // TILES_H
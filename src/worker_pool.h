@@ -0,0 +1,129 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+A fixed set of threads that wait for ParallelFor calls. The calling thread helps out, so a
+pool with zero workers simply runs everything inline.
+*/
+class worker_pool
+{
+private:
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;          // Signals workers that a new job is ready (or quit_).
+    std::condition_variable done_;          // Signals the caller that the last worker finished.
+    std::function<void(i32)> job_;          // Job of the current ParallelFor.
+    std::atomic<i32> next_;                 // Next job index to hand out.
+    i32 count_;                             // Number of job indices in the current ParallelFor.
+    i32 busyWorkers_;                       // Workers that haven't finished the current job yet.
+    u64 generation_;                        // Bumped on every ParallelFor so workers can tell jobs apart.
+    bool quit_;
+
+public:
+    worker_pool() : next_{0}, count_{0}, busyWorkers_{0}, generation_{0}, quit_{false} {}
+    ~worker_pool() { Stop(); }
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    void Start(i32 workerCount)
+    {
+        Stop();
+        quit_ = false;
+        for (i32 i = 0; i < workerCount; ++i)
+        {
+            threads_.emplace_back(&worker_pool::WorkerLoop, this);
+        }
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+        threads_.clear();
+    }
+
+    // Workers plus the calling thread
+    i32 ThreadCount() const { return static_cast<i32>(threads_.size()) + 1; }
+
+    // Runs job(i) for every i in [0, count) and returns once all of them are done
+    void ParallelFor(i32 count, const std::function<void(i32)>& job)
+    {
+        if (threads_.empty() || count <= 1)
+        {
+            for (i32 i = 0; i < count; ++i)
+            {
+                job(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = job;
+            count_ = count;
+            next_ = 0;
+            busyWorkers_ = static_cast<i32>(threads_.size());
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        RunJobs();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return busyWorkers_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    void RunJobs()
+    {
+        for (i32 i = next_++; i < count_; i = next_++)
+        {
+            job_(i);
+        }
+    }
+
+    void WorkerLoop()
+    {
+        u64 seenGeneration = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return quit_ || generation_ != seenGeneration; });
+                if (quit_)
+                {
+                    return;
+                }
+                seenGeneration = generation_;
+            }
+
+            RunJobs();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--busyWorkers_ == 0)
+                {
+                    done_.notify_one();
+                }
+            }
+        }
+    }
+};
+
+#endif // WORKER_POOL_H